@@ -0,0 +1,339 @@
+#include "pkscript.h"
+#include "Cache.h"
+#include "Compiler.h"
+#include "Memory.h"
+#include "Object.h"
+#include "Source.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char PKC_MAGIC[4] = { 'P', 'K', 'C', 0x1A };
+static const uint32_t PKC_BYTE_ORDER = 0x01020304;
+static const uint32_t PKC_STRIPPED_LINES = 1;
+
+struct CacheHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t byteOrder;
+	uint32_t codeLength;
+	uint32_t lineCount;
+	uint32_t constantCount;
+	uint32_t stringBytes;
+	uint32_t flags;
+};
+
+// Strings are stored as (offset, length) into the string section that follows the code.
+// Functions are always cached uncompiled: their name and body text go in the string section.
+struct CachedConstant
+{
+	uint8_t type;
+	uint8_t padding[3];
+	uint32_t length;
+	union
+	{
+		double number;
+		uint64_t offset;
+		uint8_t boolean;
+	} as;
+	uint64_t nameOffset;
+	uint32_t nameLength;
+	int32_t arity;
+	int32_t line;
+	uint32_t reserved;
+};
+
+enum CachedType : uint8_t
+{
+	CACHED_BOOL,
+	CACHED_NIL,
+	CACHED_NUMBER,
+	CACHED_STRING,
+	CACHED_FUNCTION,
+};
+
+struct CachedLine
+{
+	uint32_t offset;
+	int32_t line;
+};
+
+uint64_t hashSource(const char* source, size_t length, uint64_t hash)
+{
+	// FNV-1a, 64 bit. Pass the previous result as the seed to hash in pieces.
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)source[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+std::string cachePath(const std::string& sourcePath)
+{
+	size_t dot = sourcePath.find_last_of('.');
+	size_t slash = sourcePath.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return sourcePath + ".pkc";
+	return sourcePath.substr(0, dot) + ".pkc";
+}
+
+template <typename T>
+static void append(std::vector<uint8_t>& buffer, const T& value)
+{
+	const uint8_t* bytes = (const uint8_t*)&value;
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// Distinguishes the temporary files of processes and threads that write the same cache.
+static std::string writerId()
+{
+	size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+#ifndef _WIN32
+	return std::to_string(getpid()) + "-" + std::to_string(thread);
+#else
+	return std::to_string(thread);
+#endif
+}
+
+bool writeCache(const std::string& path, Chunk* chunk, uint64_t sourceHash, bool stripLines)
+{
+	std::vector<CachedConstant> constants;
+	std::string strings;
+	for (Value& value : chunk->constants)
+	{
+		CachedConstant constant = {};
+		switch (value.type)
+		{
+		case VAL_BOOL: constant.type = CACHED_BOOL; constant.as.boolean = AS_BOOL(value); break;
+		case VAL_NIL: constant.type = CACHED_NIL; break;
+		case VAL_NUMBER: constant.type = CACHED_NUMBER; constant.as.number = AS_NUMBER(value); break;
+		case VAL_OBJ:
+		{
+			if (IS_STRING(value))
+			{
+				ObjString* string = AS_STRING(value);
+				constant.type = CACHED_STRING;
+				constant.as.offset = strings.size();
+				constant.length = (uint32_t)string->string.size();
+				strings += string->string;
+			}
+			else if (IS_FUNCTION(value) && !AS_FUNCTION(value)->compiled)
+			{
+				ObjFunction* function = AS_FUNCTION(value);
+				constant.type = CACHED_FUNCTION;
+				constant.as.offset = strings.size();
+				constant.length = (uint32_t)function->source.size();
+				strings += function->source;
+				constant.nameOffset = strings.size();
+				constant.nameLength = (uint32_t)function->name->string.size();
+				strings += function->name->string;
+				constant.arity = function->arity;
+				constant.line = function->line;
+			}
+			else
+			{
+				return false;
+			}
+			break;
+		}
+		}
+		constants.push_back(constant);
+	}
+
+	CacheHeader header = {};
+	memcpy(header.magic, PKC_MAGIC, sizeof(PKC_MAGIC));
+	header.version = PKC_VERSION;
+	header.sourceHash = sourceHash;
+	header.byteOrder = PKC_BYTE_ORDER;
+	header.codeLength = (uint32_t)chunk->code.size();
+	header.lineCount = stripLines ? 0 : (uint32_t)chunk->lines.size();
+	header.constantCount = (uint32_t)constants.size();
+	header.stringBytes = (uint32_t)strings.size();
+	header.flags = stripLines ? PKC_STRIPPED_LINES : 0;
+
+	std::vector<uint8_t> buffer;
+	append(buffer, header);
+	for (CachedConstant& constant : constants) append(buffer, constant);
+	for (uint32_t i = 0; i < header.lineCount; i++)
+	{
+		CachedLine cached = { chunk->lines[i].offset, chunk->lines[i].line };
+		append(buffer, cached);
+	}
+	buffer.insert(buffer.end(), chunk->code.begin(), chunk->code.end());
+	buffer.insert(buffer.end(), strings.begin(), strings.end());
+
+	// write to a temporary file first so a concurrent run never maps a half-written cache
+	std::string temp = path + "." + writerId() + ".tmp";
+	FILE* file = fopen(temp.c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	written = fclose(file) == 0 && written;
+	if (!written || rename(temp.c_str(), path.c_str()) != 0)
+	{
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+static bool readCache(VM* vm, const uint8_t* data, size_t size, uint64_t sourceHash, Chunk* chunk, bool stripLines)
+{
+	CacheHeader header;
+	if (size < sizeof(header)) return false;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, PKC_MAGIC, sizeof(PKC_MAGIC)) != 0) return false;
+	if (header.version != PKC_VERSION) return false;
+	if (header.byteOrder != PKC_BYTE_ORDER) return false;
+	if (header.sourceHash != sourceHash) return false;
+	if (((header.flags & PKC_STRIPPED_LINES) != 0) != stripLines) return false;
+
+	uint64_t expected = sizeof(header)
+		+ (uint64_t)header.constantCount * sizeof(CachedConstant)
+		+ (uint64_t)header.lineCount * sizeof(CachedLine)
+		+ header.codeLength + header.stringBytes;
+	if (expected != size) return false;
+
+	const uint8_t* cursor = data + sizeof(header);
+	const uint8_t* constants = cursor;
+	cursor += header.constantCount * sizeof(CachedConstant);
+	const uint8_t* lines = cursor;
+	cursor += header.lineCount * sizeof(CachedLine);
+	const uint8_t* code = cursor;
+	cursor += header.codeLength;
+	const char* strings = (const char*)cursor;
+
+	chunk->constants.reserve(header.constantCount);
+	for (uint32_t i = 0; i < header.constantCount; i++)
+	{
+		CachedConstant constant;
+		memcpy(&constant, constants + i * sizeof(CachedConstant), sizeof(constant));
+		switch (constant.type)
+		{
+		case CACHED_BOOL: chunk->constants.push_back(createBool(constant.as.boolean != 0)); break;
+		case CACHED_NIL: chunk->constants.push_back(createNil()); break;
+		case CACHED_NUMBER: chunk->constants.push_back(createNumber(constant.as.number)); break;
+		case CACHED_STRING:
+			if (constant.as.offset + constant.length > header.stringBytes) return false;
+			chunk->constants.push_back(createObject((Obj*)copyString(vm, strings + constant.as.offset, constant.length)));
+			break;
+		case CACHED_FUNCTION:
+		{
+			if (constant.as.offset + constant.length > header.stringBytes) return false;
+			if (constant.nameOffset + constant.nameLength > header.stringBytes) return false;
+			ObjFunction* function = newFunction(vm);
+			function->name = copyString(vm, strings + constant.nameOffset, constant.nameLength);
+			function->source.assign(strings + constant.as.offset, constant.length);
+			accountHeap(vm, HEAP_FUNCTION, stringHeapBytes(function->source));
+			function->arity = constant.arity;
+			function->line = constant.line;
+			chunk->constants.push_back(createObject((Obj*)function));
+			break;
+		}
+		default:
+			return false;
+		}
+	}
+
+	chunk->lines.reserve(header.lineCount);
+	for (uint32_t i = 0; i < header.lineCount; i++)
+	{
+		CachedLine line;
+		memcpy(&line, lines + i * sizeof(CachedLine), sizeof(line));
+		chunk->lines.push_back({ line.offset, line.line });
+	}
+
+	chunk->code.assign(code, code + header.codeLength);
+	// a damaged or hand-made file must not send run() outside the chunk
+	for (size_t offset = 0; offset < chunk->code.size();)
+	{
+		size_t length = checkInstruction(chunk, offset);
+		if (length == 0) return false;
+		offset += length;
+	}
+	return true;
+}
+
+bool loadCache(VM* vm, const std::string& path, uint64_t sourceHash, Chunk* chunk, bool stripLines)
+{
+	bool loaded = false;
+#ifndef _WIN32
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		size_t size = (size_t)info.st_size;
+		void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED)
+		{
+			loaded = readCache(vm, (const uint8_t*)data, size, sourceHash, chunk, stripLines);
+			munmap(data, size);
+		}
+	}
+	close(fd);
+#else
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!in) return false;
+	std::vector<uint8_t> data((size_t)in.tellg());
+	in.seekg(0, std::ios::beg);
+	in.read((char*)data.data(), data.size());
+	loaded = in && readCache(vm, data.data(), data.size(), sourceHash, chunk, stripLines);
+#endif
+	if (!loaded)
+	{
+		*chunk = Chunk();
+	}
+	return loaded;
+}
+
+static uint64_t hashFile(Source* source)
+{
+	uint64_t hash = HASH_SEED;
+	for (const char* block = source->start; block < source->end; block += SOURCE_WINDOW)
+	{
+		size_t length = std::min((size_t)(source->end - block), (size_t)SOURCE_WINDOW);
+		hash = hashSource(block, length, hash);
+		slideWindow(source, block + length);
+	}
+	source->released = source->start;
+	return hash;
+}
+
+FileStatus compileFile(VM* vm, const std::string& path, bool useCache, Chunk* chunk)
+{
+	Source source;
+	if (!openSource(&source, path)) return FILE_NOT_FOUND;
+	std::string cache = cachePath(path);
+	uint64_t hash = useCache ? hashFile(&source) : 0;
+
+	bool compiled = true;
+	uint64_t started = clockNanos();
+	if (useCache && loadCache(vm, cache, hash, chunk, vm->stripLines))
+	{
+		vm->stats.compileTime += clockNanos() - started;
+		vm->stats.bytecodeBytes += chunk->code.size();
+		vm->stats.constants += chunk->constants.size();
+	}
+	else
+	{
+		compiled = compile(vm, &source, chunk);
+		if (compiled && useCache) writeCache(cache, chunk, hash, vm->stripLines);
+	}
+	closeSource(&source);
+	return compiled ? FILE_OK : FILE_COMPILE_ERROR;
+}
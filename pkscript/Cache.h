@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Chunk.h"
+#include "VM.h"
+
+#include <string>
+
+// Precompiled bytecode (.pkc) files. A cache file is only used when its magic,
+// format version and source hash all match, otherwise the script is recompiled.
+#define PKC_VERSION 5
+
+#define HASH_SEED 14695981039346656037ULL
+
+uint64_t hashSource(const char* source, size_t length, uint64_t hash = HASH_SEED);
+
+std::string cachePath(const std::string& sourcePath);
+
+// With stripLines the file carries no line table. Such a file only satisfies loads that
+// also strip, so a run that wants line numbers recompiles instead.
+bool writeCache(const std::string& path, Chunk* chunk, uint64_t sourceHash, bool stripLines = false);
+
+bool loadCache(VM* vm, const std::string& path, uint64_t sourceHash, Chunk* chunk, bool stripLines = false);
+
+enum FileStatus
+{
+	FILE_OK,
+	FILE_NOT_FOUND,
+	FILE_COMPILE_ERROR
+};
+
+// Compiles the script at `path` into `chunk`, going through its .pkc file when useCache is
+// set. Line tables are dropped when vm->stripLines is set.
+FileStatus compileFile(VM* vm, const std::string& path, bool useCache, Chunk* chunk);
@@ -0,0 +1,204 @@
+#include "Channel.h"
+#include "Object.h"
+
+#include <chrono>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+// spins before a blocked sender or receiver parks
+#define CHANNEL_SPINS 64
+
+bool toMessage(Value value, Message* message)
+{
+	switch (value.type)
+	{
+	case VAL_NIL: message->kind = Message::MESSAGE_NIL; return true;
+	case VAL_BOOL: message->kind = Message::MESSAGE_BOOL; message->boolean = AS_BOOL(value); return true;
+	case VAL_NUMBER: message->kind = Message::MESSAGE_NUMBER; message->number = AS_NUMBER(value); return true;
+	case VAL_OBJ:
+		if (IS_STRING(value))
+		{
+			message->kind = Message::MESSAGE_STRING;
+			message->string = AS_STRING(value)->string;
+			return true;
+		}
+		if (IS_CHANNEL(value))
+		{
+			message->kind = Message::MESSAGE_CHANNEL;
+			message->channel = AS_CHANNEL(value)->channel;
+			return true;
+		}
+		return false;
+	}
+	return false;
+}
+
+Value fromMessage(VM* vm, Message* message)
+{
+	switch (message->kind)
+	{
+	case Message::MESSAGE_BOOL: return createBool(message->boolean);
+	case Message::MESSAGE_NUMBER: return createNumber(message->number);
+	case Message::MESSAGE_STRING: return createObject((Obj*)takeString(vm, std::move(message->string)));
+	case Message::MESSAGE_CHANNEL: return createObject((Obj*)newChannelObject(vm, std::move(message->channel)));
+	default: return createNil();
+	}
+}
+
+std::shared_ptr<Channel> newChannel(size_t capacity)
+{
+	size_t size = 2;
+	while (size < capacity) size <<= 1;
+
+	std::shared_ptr<Channel> channel = std::make_shared<Channel>();
+	channel->mask = size - 1;
+	channel->cells.reset(new ChannelCell[size]);
+	for (size_t i = 0; i < size; i++)
+	{
+		channel->cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	channel->enqueuePosition.store(0, std::memory_order_relaxed);
+	channel->dequeuePosition.store(0, std::memory_order_relaxed);
+	channel->sleepers.store(0, std::memory_order_relaxed);
+	channel->watchers.store(0, std::memory_order_relaxed);
+	channel->eventFd.store(-1, std::memory_order_relaxed);
+	return channel;
+}
+
+Channel::~Channel()
+{
+#ifdef __linux__
+	int fd = eventFd.load(std::memory_order_relaxed);
+	if (fd >= 0) close(fd);
+#endif
+}
+
+#ifdef __linux__
+int watchChannel(Channel* channel)
+{
+	int fd = channel->eventFd.load(std::memory_order_acquire);
+	if (fd < 0)
+	{
+		int made = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (made < 0) return -1;
+		if (channel->eventFd.compare_exchange_strong(fd, made, std::memory_order_acq_rel)) fd = made;
+		else close(made);
+	}
+	channel->watchers.fetch_add(1, std::memory_order_seq_cst);
+	// clear old signals, so the descriptor only turns readable on progress from here on
+	uint64_t count;
+	while (read(fd, &count, sizeof(count)) > 0) {}
+	return fd;
+}
+#else
+int watchChannel(Channel*)
+{
+	return -1;
+}
+#endif
+
+static void wakeSleepers(Channel* channel)
+{
+#ifdef __linux__
+	if (channel->watchers.load(std::memory_order_seq_cst) != 0 && channel->watchers.exchange(0) != 0)
+	{
+		uint64_t one = 1;
+		if (write(channel->eventFd.load(std::memory_order_acquire), &one, sizeof(one)) < 0) {}
+	}
+#endif
+	if (channel->sleepers.load(std::memory_order_seq_cst) == 0) return;
+	std::lock_guard<std::mutex> guard(channel->parkLock);
+	channel->parked.notify_all();
+}
+
+bool trySend(Channel* channel, Message* message)
+{
+	size_t position = channel->enqueuePosition.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		ChannelCell* cell = &channel->cells[position & channel->mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+		if (difference == 0)
+		{
+			if (channel->enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				cell->message = std::move(*message);
+				cell->sequence.store(position + 1, std::memory_order_release);
+				wakeSleepers(channel);
+				return true;
+			}
+		}
+		else if (difference < 0)
+		{
+			return false;
+		}
+		else
+		{
+			position = channel->enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+bool tryReceive(Channel* channel, Message* message)
+{
+	size_t position = channel->dequeuePosition.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		ChannelCell* cell = &channel->cells[position & channel->mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+		if (difference == 0)
+		{
+			if (channel->dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				*message = std::move(cell->message);
+				cell->message.channel.reset();
+				cell->sequence.store(position + channel->mask + 1, std::memory_order_release);
+				wakeSleepers(channel);
+				return true;
+			}
+		}
+		else if (difference < 0)
+		{
+			return false;
+		}
+		else
+		{
+			position = channel->dequeuePosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+// Spins for a while, then sleeps until the other side makes progress. The wait is timed,
+// so a wakeup that slips in between the last try and parking costs a millisecond at most.
+template <typename Attempt>
+static void blockUntil(Channel* channel, Attempt attempt)
+{
+	for (int spin = 0; spin < CHANNEL_SPINS; spin++)
+	{
+		if (attempt()) return;
+		std::this_thread::yield();
+	}
+	channel->sleepers.fetch_add(1, std::memory_order_seq_cst);
+	while (!attempt())
+	{
+		std::unique_lock<std::mutex> lock(channel->parkLock);
+		channel->parked.wait_for(lock, std::chrono::milliseconds(1));
+	}
+	channel->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+void send(Channel* channel, Message* message)
+{
+	blockUntil(channel, [&]() { return trySend(channel, message); });
+}
+
+void receive(Channel* channel, Message* message)
+{
+	blockUntil(channel, [&]() { return tryReceive(channel, message); });
+}
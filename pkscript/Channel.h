@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Value.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct VM;
+struct Channel;
+
+// A value on its way from one VM's heap to another's. Strings are copied out of the
+// sending heap and moved into the receiving one; channels are shared by reference.
+struct Message
+{
+	enum Kind : uint8_t
+	{
+		MESSAGE_NIL,
+		MESSAGE_BOOL,
+		MESSAGE_NUMBER,
+		MESSAGE_STRING,
+		MESSAGE_CHANNEL
+	} kind;
+	bool boolean;
+	double number;
+	std::string string;
+	std::shared_ptr<Channel> channel;
+};
+
+// Returns false for values that belong to one heap only, such as functions.
+bool toMessage(Value value, Message* message);
+Value fromMessage(VM* vm, Message* message);
+
+struct ChannelCell
+{
+	std::atomic<size_t> sequence;
+	Message message;
+};
+
+// Bounded multi-producer multi-consumer queue (Vyukov's algorithm). Senders and
+// receivers only ever synchronise on the cell they claim; the mutex is only there to
+// park a thread that found the queue full or empty. A VM in an event loop parks on
+// the eventfd instead, which every send or receive signals while someone watches it.
+struct Channel
+{
+	size_t mask;
+	std::unique_ptr<ChannelCell[]> cells;
+	alignas(64) std::atomic<size_t> enqueuePosition;
+	alignas(64) std::atomic<size_t> dequeuePosition;
+	alignas(64) std::atomic<int> sleepers;
+	std::atomic<int> watchers;
+	// made by the first watchChannel(), -1 until then
+	std::atomic<int> eventFd;
+	std::mutex parkLock;
+	std::condition_variable parked;
+
+	~Channel();
+};
+
+// The capacity is rounded up to a power of two.
+std::shared_ptr<Channel> newChannel(size_t capacity);
+
+// Moves from `message` only when it returns true.
+bool trySend(Channel* channel, Message* message);
+bool tryReceive(Channel* channel, Message* message);
+
+// Block the calling thread while the channel is full or empty.
+void send(Channel* channel, Message* message);
+void receive(Channel* channel, Message* message);
+
+// Returns a descriptor that becomes readable at the channel's next send or receive.
+// Call it before the last trySend() or tryReceive(), so progress in between is not
+// missed. Another watcher can swallow the signal, so wait on it with a timeout. -1
+// where there is no eventfd.
+int watchChannel(Channel* channel);
@@ -1,12 +1,13 @@
 #include "Chunk.h"
+#include "Object.h"
+
+#include <algorithm>
 
 void writeChunk(Chunk* chunk, uint8_t byte, int line)
 {
 	chunk->code.push_back(byte);
-	if (chunk->lines.size() != 0 && line == chunk->lines.back().first)
-		chunk->lines.back().second++;
-	else
-		chunk->lines.emplace_back(std::pair<int, int>( line, 1 ));
+	if (chunk->lines.size() == 0 || line != chunk->lines.back().line)
+		chunk->lines.push_back({ (uint32_t)(chunk->code.size() - 1), line });
 }
 
 uint32_t addConstant(Chunk* chunk, Value value)
@@ -18,13 +19,13 @@ uint32_t addConstant(Chunk* chunk, Value value)
 uint32_t writeConstant(Chunk* chunk, Value value, int line)
 {
 		uint32_t index = addConstant(chunk, value);
-		if (index < UINT8_MAX)
+		if (index <= UINT8_MAX)
 		{
 			uint8_t byte3 = index & BYTE_MASK;
 			writeChunk(chunk, OP_CONSTANT_SHORT, line);
 			writeChunk(chunk, byte3, line);
 		}
-		else if (index > UINT8_MAX && index < UINT16_MAX)
+		else if (index <= UINT16_MAX)
 		{
 			uint8_t byte2 = (index >> 8) & BYTE_MASK;
 			uint8_t byte3 = index & BYTE_MASK;
@@ -32,7 +33,7 @@ uint32_t writeConstant(Chunk* chunk, Value value, int line)
 			writeChunk(chunk, byte2, line);
 			writeChunk(chunk, byte3, line);
 		}
-		else if (index > UINT16_MAX && index < UINT32_MAX)
+		else if (index <= UINT32_MAX)
 		{
 			uint8_t byte0 = (index >> 24) & BYTE_MASK;
 			uint8_t byte1 = (index >> 16) & BYTE_MASK;
@@ -53,15 +54,56 @@ uint32_t writeConstant(Chunk* chunk, Value value, int line)
 
 int getLine(Chunk* chunk, size_t offset)
 {
-	size_t lineOffset = 0;
-	for(auto linecount : chunk->lines)
-	{
-		auto line = linecount.first;
-		auto count = linecount.second;
-		lineOffset += count;
+	if (offset >= chunk->code.size()) return -1; //invalid line!
+
+	auto next = std::upper_bound(chunk->lines.begin(), chunk->lines.end(), offset,
+		[](size_t offset, const LineStart& start) { return offset < start.offset; });
+	if (next == chunk->lines.begin()) return -1; // no line info, e.g. stripped
+	return (next - 1)->line;
+}
+
+// Operand width of the constant and local instructions, which come in 1, 2 and 4 byte forms.
+static size_t operandBytes(uint8_t instruction)
+{
+	static const size_t widths[] = { 1, 2, 4 };
+	return widths[(instruction - OP_CONSTANT_SHORT) % 3];
+}
 
-		if (offset < lineOffset)
-			return line;
+size_t checkInstruction(Chunk* chunk, size_t offset)
+{
+	size_t size = chunk->code.size();
+	if (offset >= size) return 0;
+	uint8_t instruction = chunk->code[offset];
+	if (instruction >= OP_COUNT) return 0;
+
+	size_t length = 1;
+	if (instruction <= OP_SET_LOCAL_LONG) length += operandBytes(instruction);
+	else if (instruction >= OP_JUMP && instruction <= OP_JUMP_IF_FALSE) length += 2;
+	else if (instruction == OP_CALL) length += 1;
+	if (length > size - offset) return 0;
+
+	uint32_t operand = 0;
+	for (size_t i = 1; i < length; i++)
+	{
+		operand = operand << 8 | chunk->code[offset + i];
 	}
-	return -1; //invalid line!
-}
\ No newline at end of file
+	switch (instruction)
+	{
+	case OP_CONSTANT_SHORT: case OP_CONSTANT: case OP_CONSTANT_LONG:
+		if (operand >= chunk->constants.size()) return 0;
+		break;
+	case OP_DEF_GLOBAL_SHORT: case OP_DEF_GLOBAL: case OP_DEF_GLOBAL_LONG:
+	case OP_GET_GLOBAL_SHORT: case OP_GET_GLOBAL: case OP_GET_GLOBAL_LONG:
+	case OP_SET_GLOBAL_SHORT: case OP_SET_GLOBAL: case OP_SET_GLOBAL_LONG:
+		// run() takes the name as a string without looking
+		if (operand >= chunk->constants.size() || !IS_STRING(chunk->constants[operand])) return 0;
+		break;
+	case OP_JUMP_BACK:
+		if (operand > offset + length) return 0;
+		break;
+	case OP_JUMP: case OP_JUMP_IF_TRUE: case OP_JUMP_IF_FALSE:
+		if (operand > size - offset - length) return 0;
+		break;
+	}
+	return length;
+}
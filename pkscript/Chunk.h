@@ -7,10 +7,18 @@
 
 #define BYTE_MASK 0x000000FF;
 
+// Start of a run of bytecode from the same source line. Offsets are increasing, so
+// getLine() can binary search them.
+struct LineStart
+{
+    uint32_t offset;
+    int line;
+};
+
 struct Chunk
 {
     std::vector<uint8_t> code;
-    std::vector<std::pair<int, int>> lines;
+    std::vector<LineStart> lines;
     ValueArray constants;
 };
 
@@ -49,12 +57,17 @@ enum OpCode : uint8_t
     OP_JUMP_BACK,
     OP_JUMP_IF_TRUE,
     OP_JUMP_IF_FALSE,
+    OP_CALL,
+    OP_IMPORT,
     //OP_GREATER_EQUAL,
     //OP_LESS_EQUAL,
     //OP_CONSTANT_LONG_LONG, //add to support 64-byte index locations, highly unlikely this will ever be needed
     OP_PRINT,
     OP_POP,
     OP_RETURN,
+    OP_YIELD,
+    OP_RESUME,
+    OP_COUNT, // number of opcodes, not an instruction
 };
 
 uint32_t addConstant(Chunk* chunk, Value value);
@@ -63,4 +76,9 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line);
 
 uint32_t writeConstant(Chunk* chunk, Value value, int line);
 
-int getLine(Chunk* chunk, size_t offset);
\ No newline at end of file
+int getLine(Chunk* chunk, size_t offset);
+
+// Length of the instruction at `offset`, operands included, or 0 if it is not an opcode,
+// is cut off by the end of the code, jumps outside it or names a constant the chunk does
+// not have. For bytecode read back from a file before it is run or disassembled.
+size_t checkInstruction(Chunk* chunk, size_t offset);
\ No newline at end of file
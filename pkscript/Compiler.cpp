@@ -1,17 +1,27 @@
 #include "pkscript.h"
 #include "Compiler.h"
 #include "Debug.h"
+#include "Memory.h"
 #include "Object.h"
 #include "Scanner.h"
 
 #include <array>
+#include <cstring>
 
+struct Compiler;
+
+// All state for one compilation. compile() and compileFunction() each own one,
+// so independent compilations can run concurrently on different threads.
 struct Parser
 {
 	Token current;
 	Token previous;
 	bool hadError;
 	bool panicMode;
+	Scanner scanner;
+	Compiler* compiler;
+	Chunk* chunk;
+	VM* vm;
 };
 
 enum Precedence
@@ -31,8 +41,8 @@ enum Precedence
 
 struct ParseRule
 {
-	void (*prefix)(bool);
-	void (*infix)(bool);
+	void (*prefix)(Parser*, bool);
+	void (*infix)(Parser*, bool);
 	Precedence precedence;
 };
 
@@ -46,31 +56,36 @@ struct Local
 };
 
 
+enum FunctionType
+{
+	TYPE_FUNCTION,
+	TYPE_SCRIPT
+};
+
 struct Compiler
 {
+	ObjFunction* function;
+	FunctionType type;
 	std::vector<Local> locals;
 	int scopeDepth;
 };
 
 
-Parser parser;
-Compiler* current = nullptr;
-Chunk* compilingChunk;
-
-static Chunk* currentChunk()
+static Chunk* currentChunk(Parser* parser)
 {
-	return compilingChunk;
+	return parser->chunk;
 }
 
-static void errorAt(Token* token, const char* message)
+static void errorAt(Parser* parser, Token* token, const char* message)
 {
-	if (parser.panicMode) return;
-	parser.panicMode = true;
-	std::cerr << token->line << " Error" << std::endl;
+	if (parser->panicMode) return;
+	parser->panicMode = true;
+	FILE* err = parser->vm->err;
+	fprintf(err, "%d Error\n", token->line);
 
 	if(token->type == TOKEN_EOF)
 	{
-		std::cerr << " at end";
+		fprintf(err, " at end");
 	}
 	else if (token->type == TOKEN_ERROR)
 	{
@@ -78,214 +93,226 @@ static void errorAt(Token* token, const char* message)
 	}
 	else
 	{
-		fprintf(stderr, " at '%.*s'", token->length, token->start);
+		fprintf(err, " at '%.*s'", token->length, token->start);
 	}
 
-	fprintf(stderr, ": %s\n", message);
-	parser.hadError = true;
+	fprintf(err, ": %s\n", message);
+	parser->hadError = true;
 }
 
 
-static void error(const char* message)
+static void error(Parser* parser, const char* message)
 {
-	errorAt(&parser.previous, message);
+	errorAt(parser, &parser->previous, message);
 }
 
-static void errorAtCurrent(const char* message)
+static void errorAtCurrent(Parser* parser, const char* message)
 {
-	errorAt(&parser.current, message);
+	errorAt(parser, &parser->current, message);
 }
 
-static void advance()
+static void advance(Parser* parser)
 {
-	parser.previous = parser.current;
+	parser->previous = parser->current;
 
 	for(;;)
 	{
-		parser.current = scanToken();
-		if (parser.current.type != TOKEN_ERROR) break;
-		errorAtCurrent(parser.current.start);
+		parser->current = scanToken(&parser->scanner);
+		if (parser->current.type != TOKEN_ERROR) break;
+		errorAtCurrent(parser, parser->current.start);
 	}
 }
 
-static void consume(TokenType type, const char* message)
+static void consume(Parser* parser, TokenType type, const char* message)
 {
-	if (parser.current.type == type)
+	if (parser->current.type == type)
 	{
-		advance();
+		advance(parser);
 		return;
 	}
 
-	errorAtCurrent(message);
+	errorAtCurrent(parser, message);
 }
 
-static bool check(TokenType type)
+static bool check(Parser* parser, TokenType type)
 {
-	return parser.current.type == type;
+	return parser->current.type == type;
 }
 
-static bool match(TokenType type)
+static bool match(Parser* parser, TokenType type)
 {
-	if (!check(type)) return false;
-	advance();
+	if (!check(parser, type)) return false;
+	advance(parser);
 	return true;
 }
 
-static void emitByte(uint8_t byte)
+static void emitByte(Parser* parser, uint8_t byte)
 {
-	writeChunk(currentChunk(), byte, parser.previous.line);
+	writeChunk(currentChunk(parser), byte, parser->previous.line);
 }
 
-static void emitBytes(uint8_t byte1, uint8_t byte2)
+static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2)
 {
-	emitByte(byte1);
-	emitByte(byte2);
+	emitByte(parser, byte1);
+	emitByte(parser, byte2);
 }
 
-static void emitLoop(size_t loopStart)
+static void emitLoop(Parser* parser, size_t loopStart)
 {
-	emitByte(OP_JUMP_BACK);
+	emitByte(parser, OP_JUMP_BACK);
 
-	size_t offset = currentChunk()->code.size() - loopStart + 2;
-	if (offset > UINT16_MAX) error("Loop body too large.");
+	size_t offset = currentChunk(parser)->code.size() - loopStart + 2;
+	if (offset > UINT16_MAX) error(parser, "Loop body too large.");
 
-	emitByte((offset >> 8) & 0xff);
-	emitByte(offset & 0xff);
+	emitByte(parser, (offset >> 8) & 0xff);
+	emitByte(parser, offset & 0xff);
 }
 
-static int emitJump(uint8_t instruction)
+static int emitJump(Parser* parser, uint8_t instruction)
 {
-	emitByte(instruction);
-	emitBytes(0xff, 0xff);
-	return currentChunk()->code.size() - 2;
+	emitByte(parser, instruction);
+	emitBytes(parser, 0xff, 0xff);
+	return currentChunk(parser)->code.size() - 2;
 }
 
-static void emitReturn()
+static void emitReturn(Parser* parser)
 {
-	emitByte(OP_RETURN);
+	emitByte(parser, OP_NIL);
+	emitByte(parser, OP_RETURN);
 }
 
-static uint32_t emitConstant(Value value)
+static uint32_t emitConstant(Parser* parser, Value value)
 {
-	return writeConstant(currentChunk(), value, parser.previous.line);
+	return writeConstant(currentChunk(parser), value, parser->previous.line);
 }
 
-static void patchJump(int offset)
+static void patchJump(Parser* parser, int offset)
 {
-	int jump = currentChunk()->code.size() - offset - 2;
+	int jump = currentChunk(parser)->code.size() - offset - 2;
 
 	if(jump > UINT16_MAX)
 	{
-		error("Jump offset too large, must be 65,535 or lower.");
+		error(parser, "Jump offset too large, must be 65,535 or lower.");
 	}
 
-	currentChunk()->code[offset] = (jump >> 8) & BYTE_MASK;
-	currentChunk()->code[(size_t)offset+1] = jump & BYTE_MASK;
+	currentChunk(parser)->code[offset] = (jump >> 8) & BYTE_MASK;
+	currentChunk(parser)->code[(size_t)offset+1] = jump & BYTE_MASK;
 }
 
-static void initCompiler(Compiler* compiler)
+static void initCompiler(Parser* parser, Compiler* compiler, FunctionType type, ObjFunction* function)
 {
+	compiler->function = function;
+	compiler->type = type;
 	compiler->locals.clear();
 	compiler->scopeDepth = 0;
-	current = compiler;
+	parser->compiler = compiler;
+
+	if (type == TYPE_FUNCTION)
+	{
+		// slot 0 holds the function being called
+		Token name = {};
+		name.start = "";
+		compiler->locals.push_back({ name, 0 });
+	}
 }
 
 
-static void endCompiler()
+static void endCompiler(Parser* parser)
 {
-	emitReturn();
+	emitReturn(parser);
 #ifdef DEBUG_PRINT_CODE
-	if(!parser.hadError)
+	if(!parser->hadError)
 	{
-		disassembleChunk(currentChunk(), "code");
+		disassembleChunk(currentChunk(parser), parser->compiler->function != nullptr ? parser->compiler->function->name->string.c_str() : "code");
 	}
 #endif
 }
 
-static void beginScope()
+static void beginScope(Parser* parser)
 {
-	current->scopeDepth++;
+	parser->compiler->scopeDepth++;
 }
 
-static void endScope()
+static void endScope(Parser* parser)
 {
-	current->scopeDepth--;
+	parser->compiler->scopeDepth--;
 
-	while(current->locals.size() > 0 && current->locals[current->locals.size() - 1].depth > current->scopeDepth)
+	while(parser->compiler->locals.size() > 0 && parser->compiler->locals[parser->compiler->locals.size() - 1].depth > parser->compiler->scopeDepth)
 	{
-		emitByte(OP_POP);
-		current->locals.pop_back();
+		emitByte(parser, OP_POP);
+		parser->compiler->locals.pop_back();
 	}
 }
 
-static void expression();
-static void statement();
-static void declaration();
+static void expression(Parser* parser);
+static void statement(Parser* parser);
+static void declaration(Parser* parser);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
-static uint32_t identifierConstant(Token* name);
-static void emitVariable(const char* type, uint32_t index, bool global = false);
-static void and_(bool canAssign);
-static void or_(bool canAssign);
+static void parsePrecedence(Parser* parser, Precedence precedence);
+static uint32_t identifierConstant(Parser* parser, Token* name);
+static void emitVariable(Parser* parser, const char* type, uint32_t index, bool global = false);
+static void markInitialized(Parser* parser);
+static void and_(Parser* parser, bool canAssign);
+static void or_(Parser* parser, bool canAssign);
 
-static int resolveLocal(Compiler* compiler, Token* name);
+static int resolveLocal(Parser* parser, Compiler* compiler, Token* name);
 
-static void binary(bool canAssign)
+static void binary(Parser* parser, bool canAssign)
 {
-	TokenType operatorType = parser.previous.type;
+	TokenType operatorType = parser->previous.type;
 	ParseRule* rule = getRule(operatorType);
-	parsePrecedence((Precedence)(rule->precedence + 1));
+	parsePrecedence(parser, (Precedence)(rule->precedence + 1));
 
 	switch (operatorType)
 	{
-	case TOKEN_BANG_EQUAL:		emitByte(OP_EQUAL); 
-								emitByte(OP_NOT); break;
-	case TOKEN_EQUAL_EQUAL:		emitByte(OP_EQUAL); break;
-	case TOKEN_GREATER:			emitByte(OP_GREATER); break;
-	case TOKEN_GREATER_EQUAL:	emitByte(OP_LESS); 
-								emitByte(OP_NOT); break;
-	case TOKEN_LESS:			emitByte(OP_LESS); break;
-	case TOKEN_LESS_EQUAL:      emitByte(OP_GREATER); 
-								emitByte(OP_NOT); break;
-	case TOKEN_PLUS:			emitByte(OP_ADD); break;
-	case TOKEN_MINUS:			emitByte(OP_NEGATE); 
-								emitByte(OP_ADD); break;
-	case TOKEN_STAR:			emitByte(OP_MULTIPLY); break;
-	case TOKEN_SLASH:			emitByte(OP_DIVIDE); break;
+	case TOKEN_BANG_EQUAL:		emitByte(parser, OP_EQUAL); 
+								emitByte(parser, OP_NOT); break;
+	case TOKEN_EQUAL_EQUAL:		emitByte(parser, OP_EQUAL); break;
+	case TOKEN_GREATER:			emitByte(parser, OP_GREATER); break;
+	case TOKEN_GREATER_EQUAL:	emitByte(parser, OP_LESS); 
+								emitByte(parser, OP_NOT); break;
+	case TOKEN_LESS:			emitByte(parser, OP_LESS); break;
+	case TOKEN_LESS_EQUAL:      emitByte(parser, OP_GREATER); 
+								emitByte(parser, OP_NOT); break;
+	case TOKEN_PLUS:			emitByte(parser, OP_ADD); break;
+	case TOKEN_MINUS:			emitByte(parser, OP_NEGATE); 
+								emitByte(parser, OP_ADD); break;
+	case TOKEN_STAR:			emitByte(parser, OP_MULTIPLY); break;
+	case TOKEN_SLASH:			emitByte(parser, OP_DIVIDE); break;
 	}
 }
 
-static void literal(bool canAssign)
+static void literal(Parser* parser, bool canAssign)
 {
-	switch(parser.previous.type)
+	switch(parser->previous.type)
 	{
-	case TOKEN_FALSE: emitByte(OP_FALSE); break;
-	case TOKEN_TRUE: emitByte(OP_TRUE); break;
-	case TOKEN_NIL: emitByte(OP_NIL); break;
+	case TOKEN_FALSE: emitByte(parser, OP_FALSE); break;
+	case TOKEN_TRUE: emitByte(parser, OP_TRUE); break;
+	case TOKEN_NIL: emitByte(parser, OP_NIL); break;
 	default: return;
 	}
 }
 
-static void grouping(bool canAssign)
+static void grouping(Parser* parser, bool canAssign)
 {
-	expression();
-	consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+	expression(parser);
+	consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void number(bool canAssign)
+static void number(Parser* parser, bool canAssign)
 {
-	double value = strtod(parser.previous.start, nullptr);
-	emitConstant(createNumber(value));
+	double value = strtod(parser->previous.start, nullptr);
+	emitConstant(parser, createNumber(value));
 }
 
-static void string(bool canAssign)
+static void string(Parser* parser, bool canAssign)
 {
-	emitConstant(createObject((Obj*)copyString(parser.previous.start + 1, parser.previous.length - 2)));
+	emitConstant(parser, createObject((Obj*)copyString(parser->vm, parser->previous.start + 1, parser->previous.length - 2)));
 }
 
-static void namedVariable(Token name, bool canAssign)
+static void namedVariable(Parser* parser, Token name, bool canAssign)
 {
-	int arg = resolveLocal(current, &name);
+	int arg = resolveLocal(parser, parser->compiler, &name);
 	bool global;
 	if(arg != -1)
 	{
@@ -293,43 +320,74 @@ static void namedVariable(Token name, bool canAssign)
 	}
 	else
 	{
-		arg = identifierConstant(&name);
+		arg = identifierConstant(parser, &name);
 		global = true;
 	}
 	
 
-	if(canAssign && match(TOKEN_EQUAL))
+	if(canAssign && match(parser, TOKEN_EQUAL))
 	{
-		expression();
-		emitVariable("set", arg, global);
+		expression(parser);
+		emitVariable(parser, "set", arg, global);
 	}
 	else 
 	{
-		emitVariable("get", arg, global);
+		emitVariable(parser, "get", arg, global);
+	}
+}
+
+static uint8_t argumentList(Parser* parser)
+{
+	uint8_t argCount = 0;
+	if (!check(parser, TOKEN_RIGHT_PAREN))
+	{
+		do
+		{
+			expression(parser);
+			if (argCount == 255)
+			{
+				error(parser, "Can't have more than 255 arguments.");
+			}
+			argCount++;
+		} while (match(parser, TOKEN_COMMA));
 	}
+	consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+	return argCount;
 }
 
-static void variable(bool canAssign)
+static void call(Parser* parser, bool canAssign)
 {
-	namedVariable(parser.previous, canAssign);
+	uint8_t argCount = argumentList(parser);
+	emitBytes(parser, OP_CALL, argCount);
 }
 
-static void unary(bool canAssign)
+static void variable(Parser* parser, bool canAssign)
 {
-	TokenType operatorType = parser.previous.type;
+	namedVariable(parser, parser->previous, canAssign);
+}
 
-	parsePrecedence(PREC_UNARY);
+static void resume(Parser* parser, bool canAssign)
+{
+	parsePrecedence(parser, PREC_UNARY);
+	emitByte(parser, OP_RESUME);
+}
+
+static void unary(Parser* parser, bool canAssign)
+{
+	TokenType operatorType = parser->previous.type;
+
+	parsePrecedence(parser, PREC_UNARY);
 
 	switch(operatorType)
 	{
-	case TOKEN_BANG: emitByte(OP_NOT); break;
-	case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+	case TOKEN_BANG: emitByte(parser, OP_NOT); break;
+	case TOKEN_MINUS: emitByte(parser, OP_NEGATE); break;
 	default: return;
 	}
 }
 
 ParseRule rules[] = {
-	{grouping,nullptr,       PREC_NONE},  //[TOKEN_LEFT_PAREN]
+	{grouping,   call,       PREC_CALL},  //[TOKEN_LEFT_PAREN]
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_RIGHT_PAREN]
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_LEFT_BRACE]
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_RIGHT_BRACE]
@@ -358,43 +416,46 @@ ParseRule rules[] = {
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_FOR]        
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_FUN]        
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_IF]         
+	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_IMPORT]     
 	{literal, nullptr,       PREC_NONE},  //[TOKEN_NIL]        
 	{nullptr,     or_,         PREC_OR},  //[TOKEN_OR]         
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_PRINT]      
+	{resume,  nullptr,       PREC_NONE},  //[TOKEN_RESUME]     
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_RETURN]     
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_SUPER]      
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_THIS]       
 	{literal, nullptr,       PREC_NONE},  //[TOKEN_TRUE]       
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_VAR]        
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_WHILE]      
+	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_YIELD]      
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_ERROR]   
 	{nullptr, nullptr,       PREC_NONE},  //[TOKEN_EOF]    
 };
 
-static void parsePrecedence(Precedence precedence)
+static void parsePrecedence(Parser* parser, Precedence precedence)
 {
-	advance();
-	void (*prefixRule)(bool) = getRule(parser.previous.type)->prefix;
+	advance(parser);
+	void (*prefixRule)(Parser*, bool) = getRule(parser->previous.type)->prefix;
 	if (prefixRule == nullptr)
 	{
-		error("Expect expression.");
+		error(parser, "Expect expression.");
 		return;
 	}
 
 	bool canAssign = precedence <= PREC_ASSIGNMENT;
-	prefixRule(canAssign);
+	prefixRule(parser, canAssign);
 
-	while (precedence <= getRule(parser.current.type)->precedence)
+	while (precedence <= getRule(parser->current.type)->precedence)
 	{
-		advance();
-		void (*infixRule)(bool) = getRule(parser.previous.type)->infix;
-		infixRule(canAssign);
+		advance(parser);
+		void (*infixRule)(Parser*, bool) = getRule(parser->previous.type)->infix;
+		infixRule(parser, canAssign);
 	}
 }
 
-static uint32_t identifierConstant(Token* name)
+static uint32_t identifierConstant(Parser* parser, Token* name)
 {
-	return addConstant(currentChunk(), createObject((Obj*)copyString(name->start, name->length)));
+	return addConstant(currentChunk(parser), createObject((Obj*)copyString(parser->vm, name->start, name->length)));
 }
 
 static bool identifiersEqual(Token* a, Token* b)
@@ -403,16 +464,16 @@ static bool identifiersEqual(Token* a, Token* b)
 	return memcmp(a->start, b->start, a->length) == 0;
 }
 
-static int resolveLocal(Compiler* compiler, Token* name)
+static int resolveLocal(Parser* parser, Compiler* compiler, Token* name)
 {
-	for(int i = current->locals.size() - 1; i >= 0; i--)
+	for(int i = compiler->locals.size() - 1; i >= 0; i--)
 	{
 		Local* local = &compiler->locals[i];
 		if (identifiersEqual(name, &local->name))
 		{
 			if(local->depth == -1)
 			{
-				error("Can't read local variable in its own initializer.");
+				error(parser, "Can't read local variable in its own initializer.");
 			}
 			return i;
 		}
@@ -421,109 +482,116 @@ static int resolveLocal(Compiler* compiler, Token* name)
 	return -1;
 }
 
-static void addLocal(Token name)
+static void addLocal(Parser* parser, Token name)
 {
-	current->locals.push_back({ name, -1 });
+	parser->compiler->locals.push_back({ name, -1 });
 }
 
-static void declareVariable()
+static void declareVariable(Parser* parser)
 {
-	if (current->scopeDepth == 0) return;
-	Token* name = &parser.previous;
+	if (parser->compiler->scopeDepth == 0) return;
+	Token* name = &parser->previous;
 
-	for(int i = current->locals.size()-1; i >=0; i--)
+	for(int i = parser->compiler->locals.size()-1; i >=0; i--)
 	{
-		Local* local = &current->locals[i];
-		if(local->depth != -1 && local->depth < current->scopeDepth)
+		Local* local = &parser->compiler->locals[i];
+		if(local->depth != -1 && local->depth < parser->compiler->scopeDepth)
 		{
 			break;
 		}
 
 		if(identifiersEqual(name, &local->name))
 		{
-			error("Already a variable with this name in this scope.");
+			error(parser, "Already a variable with this name in this scope.");
 		}
 
 	}
-	addLocal(*name);
+	addLocal(parser, *name);
 }
 
-static uint32_t parseVariable(const char* errorMessage)
+static uint32_t parseVariable(Parser* parser, const char* errorMessage)
 {
-	consume(TOKEN_IDENTIFIER, errorMessage);
+	consume(parser, TOKEN_IDENTIFIER, errorMessage);
 
-	declareVariable();
-	if (current->scopeDepth > 0) return 0;
+	declareVariable(parser);
+	if (parser->compiler->scopeDepth > 0) return 0;
 
-	return identifierConstant(&parser.previous);
+	return identifierConstant(parser, &parser->previous);
 }
 
-static void markInitialized()
+static void markInitialized(Parser* parser)
 {
-	current->locals[(size_t)current->locals.size() -1].depth = current->scopeDepth;
+	parser->compiler->locals[(size_t)parser->compiler->locals.size() -1].depth = parser->compiler->scopeDepth;
 }
 
-static void emitVariable(const char* type , uint32_t index, bool global)
+static void defineVariable(Parser* parser, uint32_t global)
 {
-	if (!global && current->scopeDepth > 0)
+	// a local's value is already in its stack slot
+	if (parser->compiler->scopeDepth > 0)
 	{
-		markInitialized();
+		markInitialized(parser);
+		return;
 	}
-	if (index < UINT8_MAX)
+	emitVariable(parser, "def", global, true);
+}
+
+static void emitVariable(Parser* parser, const char* type , uint32_t index, bool global)
+{
+	if (index <= UINT8_MAX)
 	{
 		uint8_t byte3 = index & BYTE_MASK;
 		if (strcmp(type, "def") == 0)
 		{
 			if (global)
-				emitByte(OP_DEF_GLOBAL_SHORT);
+				emitByte(parser, OP_DEF_GLOBAL_SHORT);
 			else
-				emitByte(OP_SET_LOCAL_SHORT);
+				emitByte(parser, OP_SET_LOCAL_SHORT);
 		}
 		else if (strcmp(type, "get") == 0)
 		{
 			if (global)
-				emitByte(OP_GET_GLOBAL_SHORT);
+				emitByte(parser, OP_GET_GLOBAL_SHORT);
 			else
-				emitByte(OP_GET_LOCAL_SHORT);
+				emitByte(parser, OP_GET_LOCAL_SHORT);
 		}
 		else if (strcmp(type, "set") == 0)
 		{
 			if (global)
-				emitByte(OP_SET_GLOBAL_SHORT);
+				emitByte(parser, OP_SET_GLOBAL_SHORT);
 			else
-				emitByte(OP_SET_LOCAL_SHORT);
+				emitByte(parser, OP_SET_LOCAL_SHORT);
 		}
-		emitByte(byte3);
+		emitByte(parser, byte3);
 	}
-	else if (index > UINT8_MAX && index < UINT16_MAX)
+	else if (index <= UINT16_MAX)
 	{
 		uint8_t byte2 = (index >> 8) & BYTE_MASK;
 		uint8_t byte3 = index & BYTE_MASK;
 		if (strcmp(type, "def") == 0)
 		{
 			if (global)
-				emitByte(OP_DEF_GLOBAL);
+				emitByte(parser, OP_DEF_GLOBAL);
 			else
-				emitByte(OP_SET_LOCAL);
+				emitByte(parser, OP_SET_LOCAL);
 		}
 		else if (strcmp(type, "get") == 0)
 		{
 			if (global)
-				emitByte(OP_GET_GLOBAL);
+				emitByte(parser, OP_GET_GLOBAL);
 			else
-				emitByte(OP_GET_LOCAL);
+				emitByte(parser, OP_GET_LOCAL);
 		}
 		else if (strcmp(type, "set") == 0)
 		{
 			if (global)
-				emitByte(OP_SET_GLOBAL);
+				emitByte(parser, OP_SET_GLOBAL);
 			else
-				emitByte(OP_SET_LOCAL);
+				emitByte(parser, OP_SET_LOCAL);
 		}
-		emitByte(byte2);
-		emitByte(byte3);
+		emitByte(parser, byte2);
+		emitByte(parser, byte3);
 	}
-	else if (index > UINT16_MAX && index < UINT32_MAX)
+	else if (index <= UINT32_MAX)
 	{
 		uint8_t byte0 = (index >> 24) & BYTE_MASK;
 		uint8_t byte1 = (index >> 16) & BYTE_MASK;
@@ -532,49 +600,49 @@ static void emitVariable(const char* type , uint32_t index, bool global)
 		if (strcmp(type, "def") == 0)
 		{
 			if (global)
-				emitByte(OP_DEF_GLOBAL_LONG);
+				emitByte(parser, OP_DEF_GLOBAL_LONG);
 			else
-				emitByte(OP_SET_LOCAL_LONG);
+				emitByte(parser, OP_SET_LOCAL_LONG);
 		}
 		else if (strcmp(type, "get") == 0)
 		{
 			if (global)
-				emitByte(OP_GET_GLOBAL_LONG);
+				emitByte(parser, OP_GET_GLOBAL_LONG);
 			else
-				emitByte(OP_GET_LOCAL_LONG);
+				emitByte(parser, OP_GET_LOCAL_LONG);
 		}
 		else if (strcmp(type, "set") == 0)
 		{
 			if (global)
-				emitByte(OP_SET_GLOBAL_LONG);
+				emitByte(parser, OP_SET_GLOBAL_LONG);
 			else			
-				emitByte(OP_SET_LOCAL_LONG);
+				emitByte(parser, OP_SET_LOCAL_LONG);
 		}
-		emitByte(byte0);
-		emitByte(byte1);
-		emitByte(byte2);
-		emitByte(byte3);
+		emitByte(parser, byte0);
+		emitByte(parser, byte1);
+		emitByte(parser, byte2);
+		emitByte(parser, byte3);
 	}
 }
 
-static void and_(bool canAssign)
+static void and_(Parser* parser, bool canAssign)
 {
-	int endJump = emitJump(OP_JUMP_IF_FALSE);
+	int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
 
-	emitByte(OP_POP);
-	parsePrecedence(PREC_AND);
+	emitByte(parser, OP_POP);
+	parsePrecedence(parser, PREC_AND);
 
-	patchJump(endJump);
+	patchJump(parser, endJump);
 }
 
-static void or_(bool canAssign)
+static void or_(Parser* parser, bool canAssign)
 {
-	int elseJump = emitJump(OP_JUMP_IF_TRUE);
+	int elseJump = emitJump(parser, OP_JUMP_IF_TRUE);
 
-	emitByte(OP_POP);
-	parsePrecedence(PREC_OR);
+	emitByte(parser, OP_POP);
+	parsePrecedence(parser, PREC_OR);
 
-	patchJump(elseJump);
+	patchJump(parser, elseJump);
 }
 
 static ParseRule* getRule(TokenType type)
@@ -582,222 +650,419 @@ static ParseRule* getRule(TokenType type)
 	return &rules[type];
 }
 
-static void expression()
+static void expression(Parser* parser)
 {
-	parsePrecedence(PREC_ASSIGNMENT);
+	parsePrecedence(parser, PREC_ASSIGNMENT);
 }
 
-static void block()
+static void block(Parser* parser)
 {
-	while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+	while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF))
 	{
-		declaration();
+		declaration(parser);
 	}
 
-	consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+	consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void varDeclaration()
+static void varDeclaration(Parser* parser)
 {
-	uint32_t global = parseVariable("Expect Variable name.");
+	uint32_t global = parseVariable(parser, "Expect Variable name.");
 
-	if(match(TOKEN_EQUAL))
+	if(match(parser, TOKEN_EQUAL))
 	{
-		expression();
+		expression(parser);
 	}
 	else
 	{
-		emitByte(OP_NIL);
+		emitByte(parser, OP_NIL);
 	}
-	consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
-	emitVariable("def", global, current->scopeDepth <= 0);
+	consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+	defineVariable(parser, global);
 }
 
-static void expressionStatement()
+static void lazyFunction(Parser* parser, Token* name)
 {
-	expression();
-	consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-	emitByte(OP_POP);
+	ObjFunction* function = newFunction(parser->vm);
+	function->name = copyString(parser->vm, name->start, name->length);
+
+	consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+	Token start = parser->previous;
+	if (!check(parser, TOKEN_RIGHT_PAREN))
+	{
+		do
+		{
+			function->arity++;
+			if (function->arity > 255)
+			{
+				errorAtCurrent(parser, "Can't have more than 255 parameters.");
+			}
+			consume(parser, TOKEN_IDENTIFIER, "Expect parameter name.");
+		} while (match(parser, TOKEN_COMMA));
+	}
+	consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+	consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+
+	// the body is only brace-matched here, compileFunction() compiles it on the first call
+	int depth = 1;
+	while (depth > 0 && !check(parser, TOKEN_EOF))
+	{
+		if (check(parser, TOKEN_LEFT_BRACE)) depth++;
+		else if (check(parser, TOKEN_RIGHT_BRACE)) depth--;
+		advance(parser);
+	}
+	if (depth > 0)
+	{
+		errorAtCurrent(parser, "Expect '}' after function body.");
+		return;
+	}
+
+	function->line = start.line;
+	function->source.assign(start.start, parser->previous.start + parser->previous.length);
+	accountHeap(parser->vm, HEAP_FUNCTION, stringHeapBytes(function->source));
+	emitConstant(parser, createObject((Obj*)function));
 }
 
-static void forStatement()
+static void funDeclaration(Parser* parser)
 {
-	beginScope();
-	consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
-	if(match(TOKEN_SEMICOLON))
+	uint32_t global = parseVariable(parser, "Expect function name.");
+	Token name = parser->previous;
+	if (parser->compiler->scopeDepth > 0) markInitialized(parser);
+
+	lazyFunction(parser, &name);
+	defineVariable(parser, global);
+}
+
+static void expressionStatement(Parser* parser)
+{
+	expression(parser);
+	consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+	emitByte(parser, OP_POP);
+}
+
+static void forStatement(Parser* parser)
+{
+	beginScope(parser);
+	consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+	if(match(parser, TOKEN_SEMICOLON))
 	{
 		
 	}
-	else if (match(TOKEN_VAR))
+	else if (match(parser, TOKEN_VAR))
 	{
-		varDeclaration();
+		varDeclaration(parser);
 	}
 	else
 	{
-		expressionStatement();
+		expressionStatement(parser);
 	}
 	
-	int loopStart = currentChunk()->code.size();
+	int loopStart = currentChunk(parser)->code.size();
 	int exitJump = -1;
-	if(!match(TOKEN_SEMICOLON))
+	if(!match(parser, TOKEN_SEMICOLON))
 	{
-		expression();
-		consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+		expression(parser);
+		consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
-		exitJump = emitJump(OP_JUMP_IF_FALSE);
-		emitByte(OP_POP);
+		exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+		emitByte(parser, OP_POP);
 	}
-	if(!match(TOKEN_RIGHT_PAREN))
+	if(!match(parser, TOKEN_RIGHT_PAREN))
 	{
-		int bodyJump = emitJump(OP_JUMP);
-		int incrementStart = currentChunk()->code.size();
-		expression();
-		emitByte(OP_POP);
-		consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clause.");
+		int bodyJump = emitJump(parser, OP_JUMP);
+		int incrementStart = currentChunk(parser)->code.size();
+		expression(parser);
+		emitByte(parser, OP_POP);
+		consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clause.");
 
-		emitLoop(loopStart);
+		emitLoop(parser, loopStart);
 		loopStart = incrementStart;
-		patchJump(bodyJump);
+		patchJump(parser, bodyJump);
 	}
 
-	statement();
-	emitLoop(loopStart);
+	statement(parser);
+	emitLoop(parser, loopStart);
 
 	if (exitJump != -1)
 	{
-		patchJump(exitJump);
-		emitByte(OP_POP);
+		patchJump(parser, exitJump);
+		emitByte(parser, OP_POP);
 	}
-	endScope();
+	endScope(parser);
 }
 
-static void ifStatement()
+static void ifStatement(Parser* parser)
 {
-	consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-	expression();
-	consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+	consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+	expression(parser);
+	consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-	int thenJump = emitJump(OP_JUMP_IF_FALSE);
-	emitByte(OP_POP);
-	statement();
+	int thenJump = emitJump(parser, OP_JUMP_IF_FALSE);
+	emitByte(parser, OP_POP);
+	statement(parser);
 
-	int elseJump = emitJump(OP_JUMP);
-	patchJump(thenJump);
-	emitByte(OP_POP);
-	if (match(TOKEN_ELSE)) statement();
+	int elseJump = emitJump(parser, OP_JUMP);
+	patchJump(parser, thenJump);
+	emitByte(parser, OP_POP);
+	if (match(parser, TOKEN_ELSE)) statement(parser);
 
-	patchJump(elseJump);
+	patchJump(parser, elseJump);
 }
 
-static void printStatement()
+static void printStatement(Parser* parser)
 {
-	expression();
-	consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-	emitByte(OP_PRINT);
+	expression(parser);
+	consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+	emitByte(parser, OP_PRINT);
+}
+
+static void returnStatement(Parser* parser)
+{
+	if (parser->compiler->type == TYPE_SCRIPT)
+	{
+		error(parser, "Can't return from top-level code.");
+	}
+
+	if (match(parser, TOKEN_SEMICOLON))
+	{
+		emitReturn(parser);
+	}
+	else
+	{
+		expression(parser);
+		consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+		emitByte(parser, OP_RETURN);
+	}
 }
 
-static void whileStatement()
+static void yieldStatement(Parser* parser)
 {
-	size_t loopStart = currentChunk()->code.size();
-	consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
-	expression();
-	consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+	if (parser->compiler->type == TYPE_SCRIPT)
+	{
+		error(parser, "Can't yield from top-level code.");
+	}
+
+	if (match(parser, TOKEN_SEMICOLON))
+	{
+		emitByte(parser, OP_NIL);
+	}
+	else
+	{
+		expression(parser);
+		consume(parser, TOKEN_SEMICOLON, "Expect ';' after yield value.");
+	}
+	emitByte(parser, OP_YIELD);
+}
 
-	int exitJump = emitJump(OP_JUMP_IF_FALSE);
-	emitByte(OP_POP);
-	statement();
-	emitLoop(loopStart);
+static void importStatement(Parser* parser)
+{
+	consume(parser, TOKEN_STRING, "Expect module path after 'import'.");
+	string(parser, false);
+	consume(parser, TOKEN_SEMICOLON, "Expect ';' after module path.");
+	emitByte(parser, OP_IMPORT);
+	emitByte(parser, OP_POP);
+}
 
-	patchJump(exitJump);
-	emitByte(OP_POP);
+static void whileStatement(Parser* parser)
+{
+	size_t loopStart = currentChunk(parser)->code.size();
+	consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+	expression(parser);
+	consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+	int exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+	emitByte(parser, OP_POP);
+	statement(parser);
+	emitLoop(parser, loopStart);
+
+	patchJump(parser, exitJump);
+	emitByte(parser, OP_POP);
 }
 
-static void synchronize()
+static void synchronize(Parser* parser)
 {
-	parser.panicMode = false;
+	parser->panicMode = false;
 
-	while(parser.current.type != TOKEN_EOF)
+	while(parser->current.type != TOKEN_EOF)
 	{
-		if (parser.previous.type == TOKEN_SEMICOLON) return;
-		switch(parser.current.type)
+		if (parser->previous.type == TOKEN_SEMICOLON) return;
+		switch(parser->current.type)
 		{
 		case TOKEN_CLASS:
 		case TOKEN_FUNC:
 		case TOKEN_VAR:
 		case TOKEN_FOR:
 		case TOKEN_IF:
+		case TOKEN_IMPORT:
 		case TOKEN_WHILE:
 		case TOKEN_PRINT:
 		case TOKEN_RETURN:
+		case TOKEN_YIELD:
 			return;
 
 		default:;
 		}
 
-		advance();
+		advance(parser);
 	}
 }
 
-static void declaration()
+static void declaration(Parser* parser)
 {
-	if(match(TOKEN_VAR))
+	if (match(parser, TOKEN_FUNC))
 	{
-		varDeclaration();
+		funDeclaration(parser);
+	}
+	else if(match(parser, TOKEN_VAR))
+	{
+		varDeclaration(parser);
 	}
 	else
 	{
-		statement();
+		statement(parser);
 	}
 
-	if (parser.panicMode) synchronize();
+	if (parser->panicMode) synchronize(parser);
 }
 
-static void statement()
+static void statement(Parser* parser)
 {
-	if (match(TOKEN_PRINT))
+	if (match(parser, TOKEN_PRINT))
 	{
-		printStatement();
+		printStatement(parser);
 	}
-	else if (match(TOKEN_FOR))
+	else if (match(parser, TOKEN_FOR))
 	{
-		forStatement();
+		forStatement(parser);
 	}
-	else if (match(TOKEN_IF))
+	else if (match(parser, TOKEN_IF))
 	{
-		ifStatement();
+		ifStatement(parser);
 	}
-	else if (match(TOKEN_WHILE))
+	else if (match(parser, TOKEN_RETURN))
 	{
-		whileStatement();
+		returnStatement(parser);
 	}
-	else if (match(TOKEN_LEFT_BRACE))
+	else if (match(parser, TOKEN_YIELD))
 	{
-		beginScope();
-		block();
-		endScope();
+		yieldStatement(parser);
+	}
+	else if (match(parser, TOKEN_IMPORT))
+	{
+		importStatement(parser);
+	}
+	else if (match(parser, TOKEN_WHILE))
+	{
+		whileStatement(parser);
+	}
+	else if (match(parser, TOKEN_LEFT_BRACE))
+	{
+		beginScope(parser);
+		block(parser);
+		endScope(parser);
 	}
 	else
 	{
-		expressionStatement();
+		expressionStatement(parser);
 	}
 }
 
 bool compile(VM* vm, const char* source, Chunk* chunk)
 {
-	initScanner(source);
-	Compiler compiler;
-	initCompiler(&compiler);
-	compilingChunk = chunk;
+	Source text;
+	sourceFromString(&text, source, strlen(source));
+	return compile(vm, &text, chunk);
+}
+
+static void initParser(Parser* parser, VM* vm, Source* source, int line, Chunk* chunk)
+{
+	initScanner(&parser->scanner, source, line);
+	parser->compiler = nullptr;
+	parser->chunk = chunk;
+	parser->vm = vm;
+	parser->hadError = false;
+	parser->panicMode = false;
+}
+
+// With --stats, tokenizes the source once on its own so scanning shows up separately
+// from parsing and code generation.
+static void timeScan(VM* vm, Source* source, int line)
+{
+	if (!vm->collectStats) return;
+
+	uint64_t started = clockNanos();
+	Scanner scanner;
+	initScanner(&scanner, source, line);
+	while (scanToken(&scanner).type != TOKEN_EOF);
+	vm->stats.scanTime += clockNanos() - started;
+	source->released = source->start;
+}
 
-	parser.hadError = false;
-	parser.panicMode = false;
+static void recordCompile(VM* vm, Chunk* chunk, uint64_t started)
+{
+	if (vm->stripLines) std::vector<LineStart>().swap(chunk->lines);
+
+	vm->stats.compileTime += clockNanos() - started;
+	vm->stats.bytecodeBytes += chunk->code.size();
+	vm->stats.constants += chunk->constants.size();
+}
+
+bool compile(VM* vm, Source* source, Chunk* chunk)
+{
+	timeScan(vm, source, 1);
+	uint64_t started = clockNanos();
+	Parser parser;
+	initParser(&parser, vm, source, 1, chunk);
+	Compiler compiler;
+	initCompiler(&parser, &compiler, TYPE_SCRIPT, nullptr);
 
-	advance();
-	while (!match(TOKEN_EOF))
+	advance(&parser);
+	while (!match(&parser, TOKEN_EOF))
 	{
-		declaration();
+		declaration(&parser);
 	}
-	consume(TOKEN_EOF, "Expect end of expression.");
-	endCompiler();
+	consume(&parser, TOKEN_EOF, "Expect end of expression.");
+	endCompiler(&parser);
+	recordCompile(vm, chunk, started);
 	return !parser.hadError;
-}
\ No newline at end of file
+}
+
+bool compileFunction(VM* vm, ObjFunction* function)
+{
+	Source source;
+	sourceFromString(&source, function->source.data(), function->source.size());
+	timeScan(vm, &source, function->line);
+	uint64_t started = clockNanos();
+	Parser parser;
+	initParser(&parser, vm, &source, function->line, &function->chunk);
+	Compiler compiler;
+	initCompiler(&parser, &compiler, TYPE_FUNCTION, function);
+
+	advance(&parser);
+	beginScope(&parser);
+	consume(&parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+	if (!check(&parser, TOKEN_RIGHT_PAREN))
+	{
+		do
+		{
+			uint32_t constant = parseVariable(&parser, "Expect parameter name.");
+			defineVariable(&parser, constant);
+		} while (match(&parser, TOKEN_COMMA));
+	}
+	consume(&parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+	consume(&parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+	block(&parser);
+	endCompiler(&parser);
+	recordCompile(vm, &function->chunk, started);
+
+	if (parser.hadError)
+	{
+		function->chunk = Chunk();
+		return false;
+	}
+	function->compiled = true;
+	accountHeap(vm, HEAP_CHUNK, chunkHeapBytes(&function->chunk));
+	accountHeap(vm, HEAP_FUNCTION, -(int64_t)stringHeapBytes(function->source));
+	std::string().swap(function->source);
+	return true;
+}
@@ -1,4 +1,10 @@
 #pragma once
 #include "VM.h"
+#include "Object.h"
+#include "Source.h"
 
-bool compile(VM* vm, const char* source, Chunk* chunk);
\ No newline at end of file
+bool compile(VM* vm, Source* source, Chunk* chunk);
+bool compile(VM* vm, const char* source, Chunk* chunk);
+
+// Compiles the body of a function declared with 'func' the first time it is called.
+bool compileFunction(VM* vm, ObjFunction* function);
\ No newline at end of file
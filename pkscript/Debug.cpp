@@ -1,6 +1,12 @@
 #include "pkscript.h"
 #include "Debug.h"
 
+static size_t simpleInstruction(const char* name, size_t offset);
+static size_t byteInstruction(const char* name, Chunk* chunk, size_t offset);
+static size_t constantInstruction(const char* name, Chunk* chunk, size_t offset, uint8_t bytes);
+static size_t localInstruction(const char* name, Chunk* chunk, size_t offset, uint8_t bytes);
+static size_t jumpInstruction(const char* name, int sign, Chunk* chunk, size_t offset);
+
 void disassembleChunk(Chunk* chunk, const char* name)
 {
     printf("== %s ==\n", name);
@@ -12,7 +18,7 @@ void disassembleChunk(Chunk* chunk, const char* name)
 
 size_t disassembleInstruction(Chunk* chunk, size_t offset)
 {
-    printf("%04d ", offset);
+    printf("%04d ", (int)offset);
 
     if (offset > 0 && getLine(chunk, offset) == getLine(chunk, offset -1 ))
         printf("    | ");
@@ -40,7 +46,11 @@ size_t disassembleInstruction(Chunk* chunk, size_t offset)
     case OP_JUMP_BACK: return jumpInstruction("OP_JUMP_BACK", -1, chunk, offset);
     case OP_JUMP_IF_TRUE: return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
     case OP_JUMP_IF_FALSE: return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_CALL: return byteInstruction("OP_CALL", chunk, offset);
+    case OP_IMPORT: return simpleInstruction("OP_IMPORT", offset);
     case OP_RETURN: return simpleInstruction("OP_RETURN", offset);
+    case OP_YIELD: return simpleInstruction("OP_YIELD", offset);
+    case OP_RESUME: return simpleInstruction("OP_RESUME", offset);
     case OP_CONSTANT_SHORT: byteLength = 1; return constantInstruction("OP_CONSTANT_SHORT", chunk, offset, byteLength);
     case OP_CONSTANT: byteLength = 2; return constantInstruction("OP_CONSTANT", chunk, offset, byteLength);
     case OP_CONSTANT_LONG: byteLength = 4; return constantInstruction("OP_CONSTANT_LONG", chunk, offset, byteLength);
@@ -53,24 +63,79 @@ size_t disassembleInstruction(Chunk* chunk, size_t offset)
     case OP_SET_GLOBAL_SHORT: byteLength = 1; return constantInstruction("OP_SET_GLOBAL_SHORT", chunk, offset, byteLength);
     case OP_SET_GLOBAL: byteLength = 2; return constantInstruction("OP_SET_GLOBAL", chunk, offset, byteLength);
     case OP_SET_GLOBAL_LONG: byteLength = 4; return constantInstruction("OP_SET_GLOBAL_LONG", chunk, offset, byteLength);
-    case OP_GET_LOCAL_SHORT: byteLength = 1; return constantInstruction("OP_GET_LOCAL_SHORT", chunk, offset, byteLength);
-    case OP_GET_LOCAL: byteLength = 2; return constantInstruction("OP_GET_LOCAL", chunk, offset, byteLength);
-    case OP_GET_LOCAL_LONG: byteLength = 4; return constantInstruction("OP_GET_LOCAL_LONG", chunk, offset, byteLength);
-    case OP_SET_LOCAL_SHORT: byteLength = 1; return constantInstruction("OP_SET_LOCAL_SHORT", chunk, offset, byteLength);
-    case OP_SET_LOCAL: byteLength = 2; return constantInstruction("OP_SET_LOCAL", chunk, offset, byteLength);
-    case OP_SET_LOCAL_LONG: byteLength = 4; return constantInstruction("OP_SET_LOCAL_LONG", chunk, offset, byteLength);
+    case OP_GET_LOCAL_SHORT: byteLength = 1; return localInstruction("OP_GET_LOCAL_SHORT", chunk, offset, byteLength);
+    case OP_GET_LOCAL: byteLength = 2; return localInstruction("OP_GET_LOCAL", chunk, offset, byteLength);
+    case OP_GET_LOCAL_LONG: byteLength = 4; return localInstruction("OP_GET_LOCAL_LONG", chunk, offset, byteLength);
+    case OP_SET_LOCAL_SHORT: byteLength = 1; return localInstruction("OP_SET_LOCAL_SHORT", chunk, offset, byteLength);
+    case OP_SET_LOCAL: byteLength = 2; return localInstruction("OP_SET_LOCAL", chunk, offset, byteLength);
+    case OP_SET_LOCAL_LONG: byteLength = 4; return localInstruction("OP_SET_LOCAL_LONG", chunk, offset, byteLength);
     default:
         printf("Unknown Opcode %d\n", instruction);
         return offset + 1;
     }
 }
 
+const char* opcodeName(uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_CONSTANT_SHORT: return "OP_CONSTANT_SHORT";
+    case OP_CONSTANT: return "OP_CONSTANT";
+    case OP_CONSTANT_LONG: return "OP_CONSTANT_LONG";
+    case OP_DEF_GLOBAL_SHORT: return "OP_DEF_GLOBAL_SHORT";
+    case OP_DEF_GLOBAL: return "OP_DEF_GLOBAL";
+    case OP_DEF_GLOBAL_LONG: return "OP_DEF_GLOBAL_LONG";
+    case OP_GET_GLOBAL_SHORT: return "OP_GET_GLOBAL_SHORT";
+    case OP_GET_GLOBAL: return "OP_GET_GLOBAL";
+    case OP_GET_GLOBAL_LONG: return "OP_GET_GLOBAL_LONG";
+    case OP_SET_GLOBAL_SHORT: return "OP_SET_GLOBAL_SHORT";
+    case OP_SET_GLOBAL: return "OP_SET_GLOBAL";
+    case OP_SET_GLOBAL_LONG: return "OP_SET_GLOBAL_LONG";
+    case OP_GET_LOCAL_SHORT: return "OP_GET_LOCAL_SHORT";
+    case OP_GET_LOCAL: return "OP_GET_LOCAL";
+    case OP_GET_LOCAL_LONG: return "OP_GET_LOCAL_LONG";
+    case OP_SET_LOCAL_SHORT: return "OP_SET_LOCAL_SHORT";
+    case OP_SET_LOCAL: return "OP_SET_LOCAL";
+    case OP_SET_LOCAL_LONG: return "OP_SET_LOCAL_LONG";
+    case OP_TRUE: return "OP_TRUE";
+    case OP_FALSE: return "OP_FALSE";
+    case OP_NIL: return "OP_NIL";
+    case OP_NEGATE: return "OP_NEGATE";
+    case OP_ADD: return "OP_ADD";
+    case OP_MULTIPLY: return "OP_MULTIPLY";
+    case OP_DIVIDE: return "OP_DIVIDE";
+    case OP_NOT: return "OP_NOT";
+    case OP_EQUAL: return "OP_EQUAL";
+    case OP_GREATER: return "OP_GREATER";
+    case OP_LESS: return "OP_LESS";
+    case OP_JUMP: return "OP_JUMP";
+    case OP_JUMP_BACK: return "OP_JUMP_BACK";
+    case OP_JUMP_IF_TRUE: return "OP_JUMP_IF_TRUE";
+    case OP_JUMP_IF_FALSE: return "OP_JUMP_IF_FALSE";
+    case OP_CALL: return "OP_CALL";
+    case OP_IMPORT: return "OP_IMPORT";
+    case OP_PRINT: return "OP_PRINT";
+    case OP_POP: return "OP_POP";
+    case OP_RETURN: return "OP_RETURN";
+    case OP_YIELD: return "OP_YIELD";
+    case OP_RESUME: return "OP_RESUME";
+    default: return "OP_UNKNOWN";
+    }
+}
+
 static size_t simpleInstruction(const char* name, size_t offset)
 {
     printf("%s\n", name);
     return offset + 1;
 }
 
+static size_t byteInstruction(const char* name, Chunk* chunk, size_t offset)
+{
+    uint8_t slot = chunk->code[offset + 1];
+    printf("%-16s %4d\n", name, slot);
+    return offset + 2;
+}
+
 static size_t jumpInstruction(const char* name, int sign, Chunk* chunk, size_t offset)
 {
     uint16_t jump = (uint16_t)chunk->code[offset + 1];
@@ -79,6 +144,17 @@ static size_t jumpInstruction(const char* name, int sign, Chunk* chunk, size_t o
     return offset + 3;
 }
 
+static size_t localInstruction(const char* name, Chunk* chunk, size_t offset, uint8_t bytes)
+{
+    uint32_t slot = 0;
+    for (uint8_t i = 1; i <= bytes; i++)
+    {
+        slot = (slot << 8) + chunk->code[offset + i];
+    }
+    printf("%-16s %4d\n", name, slot);
+    return offset + 1 + bytes;
+}
+
 static size_t constantInstruction(const char* name, Chunk* chunk, size_t offset, uint8_t bytes)
 {
     uint32_t constant = chunk->code[offset + 1];
@@ -0,0 +1,66 @@
+#include "pkscript.h"
+#include "Embed.h"
+
+bool findGlobal(VM* vm, const char* name, Value* value)
+{
+	auto found = vm->globals.find(name);
+	if (found == vm->globals.end()) return false;
+	*value = found->second;
+	return true;
+}
+
+bool findFunction(VM* vm, const char* name, Value* function)
+{
+	return findGlobal(vm, name, function) && (IS_FUNCTION(*function) || IS_NATIVE(*function));
+}
+
+void setGlobal(VM* vm, const char* name, Value value)
+{
+	bindGlobal(vm, vm->globals, name, value);
+}
+
+InterpretResult invoke(VM* vm, int argCount, Value* result)
+{
+	// whatever the VM was doing when a native called back in carries on afterwards
+	size_t baseDepth = vm->baseDepth;
+	ObjCoroutine* baseCoroutine = vm->baseCoroutine;
+	uint64_t budgetEnd = vm->budgetEnd;
+	EventLoop* loop = vm->loop;
+	vm->budgetEnd = 0;
+	vm->loop = nullptr;
+
+	InterpretResult status = INTERPRET_OK;
+	size_t depth = vm->frames.size();
+	if (!callValue(vm, vm->stack[vm->stack.size() - 1 - argCount], argCount))
+	{
+		status = INTERPRET_RUNTIME_ERROR;
+	}
+	else if (vm->frames.size() > depth)
+	{
+		vm->baseDepth = vm->frames.size();
+		vm->baseCoroutine = vm->coroutine;
+		status = run(vm);
+	}
+
+	vm->baseDepth = baseDepth;
+	vm->baseCoroutine = baseCoroutine;
+	vm->budgetEnd = budgetEnd;
+	vm->loop = loop;
+	if (status == INTERPRET_OK)
+	{
+		*result = vm->stack.back();
+		vm->stack.pop_back();
+	}
+	return status;
+}
+
+size_t invokeBatch(VM* vm, Value function, int argCount, const Value* args, size_t count, Value* results)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		pushCall(vm, function);
+		for (int j = 0; j < argCount; j++) pushArgument(vm, args[i * argCount + j]);
+		if (invoke(vm, argCount, &results[i]) != INTERPRET_OK) return i;
+	}
+	return count;
+}
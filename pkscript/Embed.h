@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Object.h"
+#include "VM.h"
+
+#include <cstddef>
+
+// Calling into a VM from C++, many times over. Run the script once to define its
+// functions (interpret(), or compileFile() and interpret()), look the ones the host
+// needs up once, and from then on a call only pushes its arguments and runs the
+// function's compiled chunk: nothing is parsed and the VM is not reset.
+//
+//   Value add;
+//   if (!findFunction(&vm, "add", &add)) ...
+//   pushCall(&vm, add);
+//   pushArgument(&vm, createNumber(1));
+//   pushArgument(&vm, createNumber(2));
+//   Value sum;
+//   if (invoke(&vm, 2, &sum) != INTERPRET_OK) ...
+//
+// The VM has no collector, so returned values stay valid as long as the VM does. A
+// runtime error goes to vm->err as usual and unwinds the whole VM stack, including
+// anything a caller further out had pushed. A native may call back into the VM.
+
+// Reads the global as it is now: look it up again if the script rebinds it.
+bool findGlobal(VM* vm, const char* name, Value* value);
+
+// False too if the global is not a function or native.
+bool findFunction(VM* vm, const char* name, Value* function);
+
+void setGlobal(VM* vm, const char* name, Value value);
+
+inline void pushCall(VM* vm, Value function)
+{
+	vm->stack.push_back(function);
+}
+
+inline void pushArgument(VM* vm, Value value)
+{
+	vm->stack.push_back(value);
+}
+
+// Calls the function pushed argCount values below the top of the stack and pops it,
+// its arguments and its return value, which goes in *result. Runs to completion:
+// instruction budgets and event loops do not apply.
+InterpretResult invoke(VM* vm, int argCount, Value* result);
+
+// Calls `function` once per row of `args`, a count x argCount array, and stores each
+// return value in `results`. Returns how many calls succeeded; fewer than `count` means
+// the next one failed.
+size_t invokeBatch(VM* vm, Value function, int argCount, const Value* args, size_t count, Value* results);
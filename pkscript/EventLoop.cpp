@@ -0,0 +1,211 @@
+#include "EventLoop.h"
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#define EVENT_BATCH 64
+
+struct EventLoop
+{
+	int epoll;
+	uint64_t slice;
+	ScriptFinished finished;
+	std::deque<VM*> ready;
+	// the descriptor registered for each parked VM; a dup when another VM already
+	// waits on the same one, since epoll takes every descriptor only once
+	std::unordered_map<VM*, int> watched;
+	// VMs waiting on another thread (vm->retry): those with nothing to watch sleep here,
+	// and `timed` of the watched ones also get retried once clockNanos() passes retryAt
+	std::vector<VM*> sleeping;
+	size_t timed;
+	uint64_t retryAt;
+};
+
+bool waitForIo(VM* vm, int fd, bool writing)
+{
+	if (vm->loop != nullptr)
+	{
+		vm->waitFd = fd;
+		vm->waitWrite = writing;
+		return true;
+	}
+	if (!mayBlock(vm))
+	{
+		// a scheduler thread is shared with other scripts; try again on a later turn
+		waitForRetry(vm, fd);
+		vm->waitWrite = writing;
+		return true;
+	}
+#ifndef _WIN32
+	pollfd wait = { fd, (short)(writing ? POLLOUT : POLLIN), 0 };
+	while (poll(&wait, 1, -1) < 0 && errno == EINTR) {}
+#endif
+	return false;
+}
+
+bool mayBlock(VM* vm)
+{
+	return vm->loop == nullptr && vm->budgetEnd == 0;
+}
+
+void waitForRetry(VM* vm, int fd)
+{
+	vm->retry = true;
+	vm->waitFd = fd;
+	vm->waitWrite = false;
+}
+
+#ifdef __linux__
+EventLoop* newEventLoop(uint64_t slice, ScriptFinished finished)
+{
+	int epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll < 0) return nullptr;
+	EventLoop* loop = new EventLoop;
+	loop->epoll = epoll;
+	loop->slice = slice;
+	loop->finished = finished;
+	loop->timed = 0;
+	loop->retryAt = 0;
+	return loop;
+}
+
+void addScript(EventLoop* loop, VM* vm)
+{
+	vm->loop = loop;
+	loop->ready.push_back(vm);
+}
+
+static void holdForRetry(EventLoop* loop)
+{
+	if (loop->sleeping.empty() && loop->timed == 0) loop->retryAt = clockNanos() + RETRY_WAIT_MS * 1000000ULL;
+}
+
+static void unwatch(EventLoop* loop, VM* vm, int fd)
+{
+	epoll_ctl(loop->epoll, EPOLL_CTL_DEL, fd, nullptr);
+	if (fd != vm->waitFd) close(fd);
+	if (vm->retry) loop->timed--;
+	vm->waitFd = -1;
+	loop->ready.push_back(vm);
+}
+
+static void watch(EventLoop* loop, VM* vm)
+{
+	epoll_event event = {};
+	event.events = (vm->waitWrite ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+	event.data.ptr = vm;
+
+	int fd = vm->waitFd;
+	if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+	{
+		fd = errno == EEXIST ? dup(fd) : -1;
+		if (fd < 0 || epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+		{
+			// not pollable, so let the native find that out itself
+			if (fd >= 0) close(fd);
+			vm->waitFd = -1;
+			loop->ready.push_back(vm);
+			return;
+		}
+	}
+	if (vm->retry)
+	{
+		holdForRetry(loop);
+		loop->timed++;
+	}
+	loop->watched.emplace(vm, fd);
+}
+
+// Gives every VM waiting on another thread its next try.
+static void retryWaiting(EventLoop* loop)
+{
+	for (VM* vm : loop->sleeping) loop->ready.push_back(vm);
+	loop->sleeping.clear();
+	for (auto watched = loop->watched.begin(); loop->timed > 0 && watched != loop->watched.end();)
+	{
+		if (!watched->first->retry)
+		{
+			++watched;
+			continue;
+		}
+		unwatch(loop, watched->first, watched->second);
+		watched = loop->watched.erase(watched);
+	}
+}
+
+static void wake(EventLoop* loop, int timeout)
+{
+	epoll_event events[EVENT_BATCH];
+	int count = epoll_wait(loop->epoll, events, EVENT_BATCH, timeout);
+	for (int i = 0; i < count; i++)
+	{
+		VM* vm = (VM*)events[i].data.ptr;
+		auto watched = loop->watched.find(vm);
+		unwatch(loop, vm, watched->second);
+		loop->watched.erase(watched);
+	}
+}
+
+void runEventLoop(EventLoop* loop)
+{
+	while (!loop->ready.empty() || !loop->watched.empty() || !loop->sleeping.empty())
+	{
+		bool retrying = !loop->sleeping.empty() || loop->timed > 0;
+		if (retrying && clockNanos() >= loop->retryAt) retryWaiting(loop);
+		if (!loop->watched.empty() || (retrying && loop->ready.empty()))
+		{
+			wake(loop, !loop->ready.empty() ? 0 : retrying ? RETRY_WAIT_MS : -1);
+		}
+		if (loop->ready.empty()) continue;
+
+		VM* vm = loop->ready.front();
+		loop->ready.pop_front();
+		InterpretResult result = resume(vm, loop->slice);
+		if (result != INTERPRET_YIELDED)
+		{
+			vm->loop = nullptr;
+			loop->finished(vm, result);
+		}
+		else if (vm->waitFd >= 0)
+		{
+			watch(loop, vm);
+		}
+		else if (vm->retry)
+		{
+			holdForRetry(loop);
+			loop->sleeping.push_back(vm);
+		}
+		else
+		{
+			loop->ready.push_back(vm);
+		}
+	}
+}
+
+void freeEventLoop(EventLoop* loop)
+{
+	close(loop->epoll);
+	delete loop;
+}
+#else
+EventLoop* newEventLoop(uint64_t, ScriptFinished)
+{
+	return nullptr;
+}
+
+void addScript(EventLoop*, VM*) {}
+
+void runEventLoop(EventLoop*) {}
+
+void freeEventLoop(EventLoop*) {}
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Scheduler.h"
+#include "VM.h"
+
+// Runs many VMs on the calling thread. A native that would block on a descriptor parks
+// its VM with waitForIo() instead; the loop watches the descriptor with epoll and, once
+// it is ready, resumes the VM, which re-runs the native's call from the start. Scripts
+// that are not waiting take turns of `slice` instructions (0 runs each until it blocks
+// or ends). Only Linux has an event loop; io_uring would fit behind the same interface.
+struct EventLoop;
+
+// Returns nullptr where there is no epoll.
+EventLoop* newEventLoop(uint64_t slice, ScriptFinished finished);
+
+// `vm` must have a script started. It belongs to the loop until `finished` runs.
+void addScript(EventLoop* loop, VM* vm);
+
+// Returns once every added VM has finished.
+void runEventLoop(EventLoop* loop);
+
+void freeEventLoop(EventLoop* loop);
+
+// For a native whose call on `fd` failed with EAGAIN. Returns true if the VM has been
+// parked: the native then returns true and its result is thrown away. A VM running on a
+// scheduler's slices is parked through waitForRetry() with `fd` to watch. A VM that may
+// block waits for the descriptor right here instead, and false tells the native to try
+// again.
+bool waitForIo(VM* vm, int fd, bool writing);
+
+// True when the VM has its thread to itself: no event loop and no instruction budget.
+// Otherwise a native that would wait for another thread to make progress would also
+// stall every other VM on the thread, and calls waitForRetry() instead of blocking.
+bool mayBlock(VM* vm);
+
+// Yields the VM with vm->retry set; the native then returns true and the call runs
+// again later: once `fd` (if any, see watchChannel()) turns readable, or writable with
+// vm->waitWrite, or RETRY_WAIT_MS have passed, and under a scheduler possibly on the
+// VM's next turn.
+void waitForRetry(VM* vm, int fd = -1);
@@ -0,0 +1,100 @@
+#include "pkscript.h"
+#include "HeapProfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <tuple>
+#include <vector>
+
+std::atomic<unsigned> heapDumpRequests(0);
+
+HeapProfile* newHeapProfile(const std::string& path, uint64_t interval)
+{
+	// start with an empty file; every dump is appended to it
+	FILE* out = fopen(path.c_str(), "w");
+	if (out == nullptr) return nullptr;
+	fclose(out);
+
+	HeapProfile* profile = new HeapProfile();
+	profile->interval = interval > 0 ? interval : 1;
+	profile->untilSample = (int64_t)profile->interval;
+	profile->dumpsHandled = heapDumpRequests.load(std::memory_order_relaxed);
+	profile->path = path;
+	return profile;
+}
+
+void freeHeapProfile(HeapProfile* profile)
+{
+	delete profile;
+}
+
+void recordAllocation(VM* vm, Obj* object, ObjType type, size_t bytes)
+{
+	HeapProfile* profile = vm->heapProfile;
+	if (profile->untilSample <= 0)
+	{
+		SampledObject sample;
+		sample.site.function = vm->function;
+		sample.site.line = -1;
+		sample.site.type = type;
+		// outside run() (compiling a script, say) there is no instruction to blame
+		if (vm->chunk != nullptr && vm->ip != nullptr)
+		{
+			size_t offset = (size_t)(vm->ip - vm->chunk->code.data());
+			sample.site.line = getLine(vm->chunk, offset > 0 ? offset - 1 : 0);
+		}
+		sample.bytes = bytes;
+		sample.weight = std::max((size_t)profile->interval, bytes);
+		profile->live[object] = sample;
+
+		profile->untilSample = (int64_t)profile->interval;
+	}
+	pollHeapDump(vm);
+}
+
+struct SiteTotal
+{
+	std::string site;
+	const char* type;
+	size_t samples;
+	double objects;
+	size_t bytes;
+};
+
+bool dumpHeapProfile(VM* vm)
+{
+	HeapProfile* profile = vm->heapProfile;
+	if (profile == nullptr) return false;
+
+	std::map<std::tuple<ObjFunction*, int, ObjType>, SiteTotal> sites;
+	for (auto& entry : profile->live)
+	{
+		SampledObject& sample = entry.second;
+		SiteTotal& total = sites[std::make_tuple(sample.site.function, sample.site.line, sample.site.type)];
+		if (total.samples == 0)
+		{
+			total.site = sample.site.function == nullptr ? "script" : sample.site.function->name->string;
+			total.site += sample.site.line < 0 ? ":?" : ":" + std::to_string(sample.site.line);
+			total.type = objTypeName(sample.site.type);
+		}
+		total.samples++;
+		total.objects += (double)sample.weight / sample.bytes;
+		total.bytes += sample.weight;
+	}
+
+	std::vector<SiteTotal> sorted;
+	for (auto& site : sites) sorted.push_back(site.second);
+	std::sort(sorted.begin(), sorted.end(), [](const SiteTotal& a, const SiteTotal& b) { return a.bytes > b.bytes; });
+
+	FILE* out = fopen(profile->path.c_str(), "a");
+	if (out == nullptr) return false;
+	fprintf(out, "== live heap: %llu bytes in use, sampled every %llu bytes ==\n",
+		(unsigned long long)vm->stats.bytesAllocated, (unsigned long long)profile->interval);
+	fprintf(out, "%14s %10s %8s  %-8s %s\n", "est. bytes", "est. objs", "samples", "type", "site");
+	for (SiteTotal& total : sorted)
+	{
+		fprintf(out, "%14zu %10.0f %8zu  %-8s %s\n", total.bytes, total.objects, total.samples, total.type, total.site.c_str());
+	}
+	return fclose(out) == 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Object.h"
+#include "VM.h"
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+// Allocation-site heap profiler for --heap-profile. Roughly one allocation per
+// `interval` bytes is sampled and remembered with the function and line that was
+// executing when it was made; freeing the object forgets it again. A dump aggregates
+// the live samples by site and type, scaled up to estimated totals.
+#define HEAP_SAMPLE_INTERVAL (64 * 1024)
+
+struct AllocationSite
+{
+	ObjFunction* function;
+	int line;
+	ObjType type;
+};
+
+struct SampledObject
+{
+	AllocationSite site;
+	size_t bytes;
+	// bytes of allocation this sample stands for
+	size_t weight;
+};
+
+struct HeapProfile
+{
+	uint64_t interval;
+	int64_t untilSample;
+	// the value of heapDumpRequests this profile last dumped for
+	unsigned dumpsHandled;
+	std::string path;
+	std::unordered_map<Obj*, SampledObject> live;
+};
+
+// Bumped from a SIGUSR2 handler. Every profiled VM that sees a new value writes a dump
+// at its next allocation, backward jump or call, whichever thread it runs on.
+extern std::atomic<unsigned> heapDumpRequests;
+
+HeapProfile* newHeapProfile(const std::string& path, uint64_t interval = HEAP_SAMPLE_INTERVAL);
+
+// Called by freeVM() once the VM's objects are gone.
+void freeHeapProfile(HeapProfile* profile);
+
+// Appends the aggregated live samples to the profile's file.
+bool dumpHeapProfile(VM* vm);
+
+void recordAllocation(VM* vm, Obj* object, ObjType type, size_t bytes);
+
+// Writes the dump heapDumpRequests asks for, if this VM has not written it yet.
+static inline void pollHeapDump(VM* vm)
+{
+	HeapProfile* profile = vm->heapProfile;
+	if (profile == nullptr) return;
+	unsigned requests = heapDumpRequests.load(std::memory_order_relaxed);
+	if (requests == profile->dumpsHandled) return;
+	profile->dumpsHandled = requests;
+	dumpHeapProfile(vm);
+}
+
+static inline void sampleAllocation(VM* vm, Obj* object, ObjType type, size_t bytes)
+{
+	HeapProfile* profile = vm->heapProfile;
+	if (profile == nullptr) return;
+	profile->untilSample -= (int64_t)bytes;
+	if (profile->untilSample <= 0 || heapDumpRequests.load(std::memory_order_relaxed) != profile->dumpsHandled)
+	{
+		recordAllocation(vm, object, type, bytes);
+	}
+}
+
+static inline void forgetAllocation(VM* vm, Obj* object)
+{
+	if (vm->heapProfile != nullptr && !vm->heapProfile->live.empty()) vm->heapProfile->live.erase(object);
+}
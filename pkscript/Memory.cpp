@@ -2,9 +2,19 @@
 #include "Memory.h"
 #include "Object.h"
 #include "VM.h"
+#include "HeapProfile.h"
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize)
+void accountHeap(VM* vm, HeapCategory category, int64_t bytes)
 {
+	vm->stats.heapBytes[category] += bytes;
+	vm->stats.bytesAllocated += bytes;
+	if (vm->stats.bytesAllocated > vm->stats.peakBytes) vm->stats.peakBytes = vm->stats.bytesAllocated;
+}
+
+void* reallocate(VM* vm, HeapCategory category, void* pointer, size_t oldSize, size_t newSize)
+{
+	accountHeap(vm, category, (int64_t)newSize - (int64_t)oldSize);
+
 	if (newSize == 0)
 	{
 		free(pointer);
@@ -12,30 +22,119 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize)
 	}
 
 	void* result = realloc(pointer, newSize);
-	if (result == nullptr) exit(1);
+	if (result == nullptr)
+	{
+		fputs("Out of memory.\n", stderr);
+		exit(1);
+	}
 	return result;
 }
 
-static void freeObject(Obj* object)
+size_t stringHeapBytes(const std::string& string)
+{
+	const char* data = string.data();
+	const char* self = (const char*)&string;
+	if (data >= self && data < self + sizeof(string)) return 0;
+	return string.capacity() + 1;
+}
+
+size_t chunkHeapBytes(Chunk* chunk)
 {
+	return chunk->code.capacity()
+		+ chunk->lines.capacity() * sizeof(LineStart)
+		+ chunk->constants.capacity() * sizeof(Value);
+}
+
+static void freeObject(VM* vm, Obj* object)
+{
+	forgetAllocation(vm, object);
 	switch(object->type)
 	{
 	case OBJ_STRING:
 	{
 		ObjString* string = (ObjString*)object;
-		delete string;
+		accountHeap(vm, HEAP_STRING, -(int64_t)stringHeapBytes(string->string));
+		string->~ObjString();
+		reallocate(vm, HEAP_STRING, string, sizeof(ObjString), 0);
+		break;
+	}
+	case OBJ_FUNCTION:
+	{
+		ObjFunction* function = (ObjFunction*)object;
+		accountHeap(vm, HEAP_FUNCTION, -(int64_t)stringHeapBytes(function->source));
+		accountHeap(vm, HEAP_CHUNK, -(int64_t)chunkHeapBytes(&function->chunk));
+		function->~ObjFunction();
+		reallocate(vm, HEAP_FUNCTION, function, sizeof(ObjFunction), 0);
+		break;
 	}
+	case OBJ_NATIVE:
+		reallocate(vm, HEAP_FUNCTION, object, sizeof(ObjNative), 0);
+		break;
+	case OBJ_COROUTINE:
+	{
+		ObjCoroutine* coroutine = (ObjCoroutine*)object;
+		accountHeap(vm, HEAP_STACK, -(int64_t)coroutine->stackBytes);
+		coroutine->~ObjCoroutine();
+		reallocate(vm, HEAP_COROUTINE, coroutine, sizeof(ObjCoroutine), 0);
+		break;
+	}
+	case OBJ_CHANNEL:
+	{
+		ObjChannel* channel = (ObjChannel*)object;
+		channel->~ObjChannel();
+		reallocate(vm, HEAP_TASK, channel, sizeof(ObjChannel), 0);
+		break;
+	}
+	case OBJ_TASK:
+	{
+		// a VM does not go away while tasks it spawned are still running
+		ObjTask* task = (ObjTask*)object;
+		if (task->thread.joinable()) task->thread.join();
+		task->~ObjTask();
+		reallocate(vm, HEAP_TASK, task, sizeof(ObjTask), 0);
+		break;
+	}
+	}
+}
+
+void freeStrings(VM* vm, const std::unordered_set<Obj*>& dead)
+{
+	size_t left = dead.size();
+	for (Obj** link = &vm->objects; *link != nullptr && left > 0;)
+	{
+		Obj* object = *link;
+		if (dead.count(object) == 0)
+		{
+			link = &object->next;
+			continue;
+		}
+		*link = object->next;
+		auto entry = vm->strings.find(((ObjString*)object)->string);
+		if (entry != vm->strings.end() && entry->second == (ObjString*)object)
+		{
+			accountHeap(vm, HEAP_INTERN, -(int64_t)(INTERN_ENTRY_BYTES + stringHeapBytes(entry->first)));
+			vm->strings.erase(entry);
+		}
+		freeObject(vm, object);
+		left--;
 	}
 }
 
-void freeObjects()
+void freeObjects(VM* vm)
 {
-	Obj* object = currentVM()->objects;
+	Obj* object = vm->objects;
 
 	while(object != nullptr)
 	{
 		Obj* next = object->next;
-		freeObject(object);
+		freeObject(vm, object);
 		object = next;
 	}
+	vm->objects = nullptr;
+
+	for (auto& entry : vm->strings)
+	{
+		accountHeap(vm, HEAP_INTERN, -(int64_t)(INTERN_ENTRY_BYTES + stringHeapBytes(entry.first)));
+	}
+	vm->strings.clear();
 }
\ No newline at end of file
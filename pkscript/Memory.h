@@ -1,8 +1,49 @@
 #pragma once
 
-#define ALLOCATE(type, count) \
-	(type*)reallocate(nullptr, 0, sizeof(type) * (count))
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+struct VM;
+struct Chunk;
 
-void freeObjects();
\ No newline at end of file
+// What the bytes in VMStats::heapBytes are spent on.
+enum HeapCategory
+{
+	HEAP_STRING, // ObjString and its characters
+	HEAP_FUNCTION, // ObjFunction, ObjNative and the body text of uncompiled functions
+	HEAP_INTERN, // entries of vm->strings
+	HEAP_CHUNK, // code, line and constant buffers of compiled chunks
+	HEAP_COROUTINE, // ObjCoroutine itself
+	HEAP_STACK, // operand stacks and frame buffers of the VM and its coroutines
+	HEAP_GLOBAL, // entries of vm->globals and of module exports
+	HEAP_TASK, // ObjTask and ObjChannel; channel buffers are shared between VMs and not counted
+	HEAP_CATEGORY_COUNT
+};
+
+#define ALLOCATE(vm, category, type, count) \
+	(type*)reallocate(vm, category, nullptr, 0, sizeof(type) * (count))
+
+// Every heap object goes through here so vm->stats sees the bytes.
+void* reallocate(VM* vm, HeapCategory category, void* pointer, size_t oldSize, size_t newSize);
+
+// Charges (or with a negative size, releases) memory that is allocated elsewhere, such
+// as std::string and std::vector buffers, to the VM's accounting.
+void accountHeap(VM* vm, HeapCategory category, int64_t bytes);
+
+// Heap bytes behind a std::string, zero while it fits in the small string buffer.
+size_t stringHeapBytes(const std::string& string);
+
+size_t chunkHeapBytes(Chunk* chunk);
+
+// Rough cost of one vm->strings entry besides its key characters.
+#define INTERN_ENTRY_BYTES (sizeof(std::pair<const std::string, void*>) + 2 * sizeof(void*))
+
+void freeObjects(VM* vm);
+
+struct Obj;
+
+// Frees the strings in `dead` and drops them from the intern table. Nothing may still
+// refer to them; there is no collector to check that.
+void freeStrings(VM* vm, const std::unordered_set<Obj*>& dead);
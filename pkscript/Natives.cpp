@@ -0,0 +1,410 @@
+#include "Natives.h"
+#include "Compiler.h"
+#include "EventLoop.h"
+#include "Object.h"
+#include "Spawn.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// largest read() a script can ask for in one call
+#define READ_MAX (1 << 20)
+
+#define CHANNEL_CAPACITY 64
+#define CHANNEL_CAPACITY_MAX (1 << 20)
+
+static void defineNative(VM* vm, const char* name, int arity, NativeFn function)
+{
+	bindGlobal(vm, vm->globals, name, createObject((Obj*)newNative(vm, name, arity, function)));
+}
+
+// coroutine(fn, args...) makes a coroutine that calls fn(args...) on its first resume.
+static bool coroutineNative(VM* vm, int argCount, Value* args, Value* result)
+{
+	if (argCount < 1 || !IS_FUNCTION(args[0]))
+	{
+		runtimeError(vm, "coroutine() takes a function and its arguments.");
+		return false;
+	}
+	ObjFunction* function = AS_FUNCTION(args[0]);
+	if (!function->compiled && !compileFunction(vm, function))
+	{
+		runtimeError(vm, "Could not compile function '%s'.", function->name->string.c_str());
+		return false;
+	}
+	if (argCount - 1 != function->arity)
+	{
+		runtimeError(vm, "Expected %d arguments but got %d.", function->arity, argCount - 1);
+		return false;
+	}
+	*result = createObject((Obj*)newCoroutine(vm, function, argCount - 1, args + 1));
+	return true;
+}
+
+// done(co) is true once co has returned.
+static bool doneNative(VM* vm, int, Value* args, Value* result)
+{
+	if (!IS_COROUTINE(args[0]))
+	{
+		runtimeError(vm, "done() takes a coroutine.");
+		return false;
+	}
+	*result = createBool(AS_COROUTINE(args[0])->state == COROUTINE_DONE);
+	return true;
+}
+
+// spawn(fn, args...) or spawn(path) starts a task on a new thread.
+static bool spawnNative(VM* vm, int argCount, Value* args, Value* result)
+{
+	ObjTask* task = nullptr;
+	if (argCount == 1 && IS_STRING(args[0]))
+	{
+		task = spawnFile(vm, AS_STRING(args[0])->string);
+	}
+	else if (argCount >= 1 && IS_FUNCTION(args[0]))
+	{
+		ObjFunction* function = AS_FUNCTION(args[0]);
+		if (argCount - 1 != function->arity)
+		{
+			runtimeError(vm, "Expected %d arguments but got %d.", function->arity, argCount - 1);
+			return false;
+		}
+		task = spawnFunction(vm, function, argCount - 1, args + 1);
+		if (task == nullptr) return false;
+	}
+	else
+	{
+		runtimeError(vm, "spawn() takes a function and its arguments, or a script path.");
+		return false;
+	}
+	*result = createObject((Obj*)task);
+	return true;
+}
+
+// join(task) waits for the task and returns what its function returned.
+static bool joinNative(VM* vm, int, Value* args, Value* result)
+{
+	if (!IS_TASK(args[0]))
+	{
+		runtimeError(vm, "join() takes a task.");
+		return false;
+	}
+	ObjTask* task = AS_TASK(args[0]);
+	if (!task->joined && !task->finished.load(std::memory_order_acquire) && !mayBlock(vm))
+	{
+		waitForRetry(vm);
+		return true;
+	}
+	if (!joinTask(vm, task, result))
+	{
+		runtimeError(vm, "Spawned task failed.");
+		return false;
+	}
+	return true;
+}
+
+// channel(capacity) makes a bounded channel; the capacity defaults to CHANNEL_CAPACITY.
+static bool channelNative(VM* vm, int argCount, Value* args, Value* result)
+{
+	size_t capacity = CHANNEL_CAPACITY;
+	if (argCount > 1 || (argCount == 1 && (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 1)))
+	{
+		runtimeError(vm, "channel() takes an optional capacity.");
+		return false;
+	}
+	if (argCount == 1) capacity = (size_t)std::min(AS_NUMBER(args[0]), (double)CHANNEL_CAPACITY_MAX);
+	*result = createObject((Obj*)newChannelObject(vm, newChannel(capacity)));
+	return true;
+}
+
+// send(channel, value) copies value into the channel, waiting while it is full.
+static bool sendNative(VM* vm, int, Value* args, Value*)
+{
+	if (!IS_CHANNEL(args[0]))
+	{
+		runtimeError(vm, "send() takes a channel.");
+		return false;
+	}
+	Message message;
+	if (!toMessage(args[1], &message))
+	{
+		runtimeError(vm, "send() can only pass numbers, bools, nil, strings and channels.");
+		return false;
+	}
+	Channel* channel = AS_CHANNEL(args[0])->channel.get();
+	if (trySend(channel, &message)) return true;
+	if (mayBlock(vm))
+	{
+		send(channel, &message);
+		return true;
+	}
+	int fd = watchChannel(channel);
+	if (!trySend(channel, &message)) waitForRetry(vm, fd);
+	return true;
+}
+
+// receive(channel) waits for the next value.
+static bool receiveNative(VM* vm, int, Value* args, Value* result)
+{
+	if (!IS_CHANNEL(args[0]))
+	{
+		runtimeError(vm, "receive() takes a channel.");
+		return false;
+	}
+	Message message;
+	Channel* channel = AS_CHANNEL(args[0])->channel.get();
+	if (!tryReceive(channel, &message))
+	{
+		if (mayBlock(vm))
+		{
+			receive(channel, &message);
+		}
+		else
+		{
+			int fd = watchChannel(channel);
+			if (!tryReceive(channel, &message))
+			{
+				waitForRetry(vm, fd);
+				return true;
+			}
+		}
+	}
+	*result = fromMessage(vm, &message);
+	return true;
+}
+
+#ifndef _WIN32
+// Descriptors are plain numbers in scripts, but only those in vm->files: the ones this
+// VM opened itself. Everything opened here is non-blocking, so an operation that cannot
+// go ahead fails with EAGAIN and waits through waitForIo().
+static bool fdArgument(VM* vm, Value value, const char* native, int* fd)
+{
+	if (!IS_NUMBER(value) || AS_NUMBER(value) < 0 || AS_NUMBER(value) != (int)AS_NUMBER(value)
+		|| vm->files.count((int)AS_NUMBER(value)) == 0)
+	{
+		runtimeError(vm, "%s() takes a file descriptor opened by this script.", native);
+		return false;
+	}
+	*fd = (int)AS_NUMBER(value);
+	return true;
+}
+
+static Value newFile(VM* vm, int fd)
+{
+	vm->files.insert(fd);
+	return createNumber(fd);
+}
+
+static bool setNonBlocking(int fd)
+{
+	return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0 && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+}
+
+static bool ioError(VM* vm, const char* native)
+{
+	runtimeError(vm, "%s() failed: %s.", native, strerror(errno));
+	return false;
+}
+
+static bool unixAddress(VM* vm, Value value, const char* native, sockaddr_un* address)
+{
+	if (!IS_STRING(value) || AS_STRING(value)->string.size() >= sizeof(address->sun_path))
+	{
+		runtimeError(vm, "%s() takes a socket path.", native);
+		return false;
+	}
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	memcpy(address->sun_path, AS_CSTRING(value), AS_STRING(value)->string.size());
+	return true;
+}
+
+// open(path, mode) with mode "r", "w" or "a". Works for files and named pipes.
+static bool openNative(VM* vm, int, Value* args, Value* result)
+{
+	if (!IS_STRING(args[0]) || !IS_STRING(args[1]))
+	{
+		runtimeError(vm, "open() takes a path and a mode.");
+		return false;
+	}
+	const std::string& mode = AS_STRING(args[1])->string;
+	int flags;
+	if (mode == "r") flags = O_RDONLY;
+	else if (mode == "w") flags = O_WRONLY | O_CREAT | O_TRUNC;
+	else if (mode == "a") flags = O_WRONLY | O_CREAT | O_APPEND;
+	else
+	{
+		runtimeError(vm, "open() mode must be \"r\", \"w\" or \"a\".");
+		return false;
+	}
+	int fd = open(AS_CSTRING(args[0]), flags | O_NONBLOCK | O_CLOEXEC, 0666);
+	if (fd < 0) return ioError(vm, "open");
+	*result = newFile(vm, fd);
+	return true;
+}
+
+// read(fd, max) returns up to max bytes as a string, or nil at the end of the input.
+static bool readNative(VM* vm, int, Value* args, Value* result)
+{
+	int fd;
+	if (!fdArgument(vm, args[0], "read", &fd)) return false;
+	if (!IS_NUMBER(args[1]) || AS_NUMBER(args[1]) < 1)
+	{
+		runtimeError(vm, "read() takes a byte count.");
+		return false;
+	}
+	size_t max = (size_t)std::min(AS_NUMBER(args[1]), (double)READ_MAX);
+
+	std::string buffer(max, '\0');
+	for (;;)
+	{
+		ssize_t count = read(fd, &buffer[0], max);
+		if (count > 0)
+		{
+			buffer.resize((size_t)count);
+			*result = createObject((Obj*)takeString(vm, buffer));
+			return true;
+		}
+		if (count == 0) return true;
+		if (errno == EINTR) continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) return ioError(vm, "read");
+		if (waitForIo(vm, fd, false)) return true;
+	}
+}
+
+// write(fd, string) returns how many bytes went out, which can be fewer than all of them.
+static bool writeNative(VM* vm, int, Value* args, Value* result)
+{
+	int fd;
+	if (!fdArgument(vm, args[0], "write", &fd)) return false;
+	if (!IS_STRING(args[1]))
+	{
+		runtimeError(vm, "write() takes a string.");
+		return false;
+	}
+	const std::string& data = AS_STRING(args[1])->string;
+	for (;;)
+	{
+		ssize_t count = write(fd, data.data(), data.size());
+		if (count >= 0)
+		{
+			*result = createNumber((double)count);
+			return true;
+		}
+		if (errno == EINTR) continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) return ioError(vm, "write");
+		if (waitForIo(vm, fd, true)) return true;
+	}
+}
+
+static bool closeNative(VM* vm, int, Value* args, Value*)
+{
+	int fd;
+	if (!fdArgument(vm, args[0], "close", &fd)) return false;
+	// the descriptor is gone even when close() reports an error
+	vm->files.erase(fd);
+	if (close(fd) != 0) return ioError(vm, "close");
+	return true;
+}
+
+// listen(path) binds a Unix stream socket at path and returns it, ready for accept().
+static bool listenNative(VM* vm, int, Value* args, Value* result)
+{
+	sockaddr_un address;
+	if (!unixAddress(vm, args[0], "listen", &address)) return false;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return ioError(vm, "listen");
+	if (!setNonBlocking(fd) || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return ioError(vm, "listen");
+	}
+	*result = newFile(vm, fd);
+	return true;
+}
+
+static bool acceptNative(VM* vm, int, Value* args, Value* result)
+{
+	int fd;
+	if (!fdArgument(vm, args[0], "accept", &fd)) return false;
+	for (;;)
+	{
+		int client = accept(fd, nullptr, nullptr);
+		if (client >= 0)
+		{
+			if (!setNonBlocking(client))
+			{
+				close(client);
+				return ioError(vm, "accept");
+			}
+			*result = newFile(vm, client);
+			return true;
+		}
+		if (errno == EINTR || errno == ECONNABORTED) continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) return ioError(vm, "accept");
+		if (waitForIo(vm, fd, false)) return true;
+	}
+}
+
+// connect(path) to a Unix stream socket. A local connect does not wait for the other
+// side, so it is made before the socket is switched to non-blocking.
+static bool connectNative(VM* vm, int, Value* args, Value* result)
+{
+	sockaddr_un address;
+	if (!unixAddress(vm, args[0], "connect", &address)) return false;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return ioError(vm, "connect");
+	if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0 || !setNonBlocking(fd))
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return ioError(vm, "connect");
+	}
+	*result = newFile(vm, fd);
+	return true;
+}
+#endif
+
+void defineNatives(VM* vm)
+{
+	defineNative(vm, "coroutine", -1, coroutineNative);
+	defineNative(vm, "done", 1, doneNative);
+	defineNative(vm, "spawn", -1, spawnNative);
+	defineNative(vm, "join", 1, joinNative);
+	defineNative(vm, "channel", -1, channelNative);
+	defineNative(vm, "send", 2, sendNative);
+	defineNative(vm, "receive", 1, receiveNative);
+}
+
+void defineIoNatives(VM* vm)
+{
+	vm->ioNatives = true;
+#ifndef _WIN32
+	defineNative(vm, "open", 2, openNative);
+	defineNative(vm, "read", 2, readNative);
+	defineNative(vm, "write", 2, writeNative);
+	defineNative(vm, "close", 1, closeNative);
+	defineNative(vm, "listen", 1, listenNative);
+	defineNative(vm, "accept", 1, acceptNative);
+	defineNative(vm, "connect", 1, connectNative);
+#endif
+}
+
+void closeFiles(VM* vm)
+{
+#ifndef _WIN32
+	for (int fd : vm->files) close(fd);
+#endif
+	vm->files.clear();
+}
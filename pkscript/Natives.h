@@ -0,0 +1,15 @@
+#pragma once
+
+#include "VM.h"
+
+// Binds the built-in functions as globals of `vm`.
+void defineNatives(VM* vm);
+
+// Binds open/read/write/close/listen/accept/connect as well, for hosts that trust their
+// scripts with files and local sockets. The descriptors these hand out are the only ones
+// they accept, so a script can't reach stdio or another VM's descriptors; tasks spawned
+// by `vm` get the natives too, with descriptor tables of their own.
+void defineIoNatives(VM* vm);
+
+// Closes the descriptors the I/O natives opened for `vm` and left open, for freeVM().
+void closeFiles(VM* vm);
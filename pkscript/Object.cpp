@@ -1,50 +1,140 @@
 #include "pkscript.h"
 #include "Object.h"
 #include "Memory.h"
+#include "HeapProfile.h"
 #include "VM.h"
 
+#include <new>
 
-static Obj* allocateObject(Obj* object, ObjType type)
+
+// `bytes` is what the object costs in all, for the heap profiler.
+static Obj* allocateObject(VM* vm, Obj* object, ObjType type, size_t bytes)
 {
 	object->type = type;
-	VM* vm = currentVM();
 	object->next = vm->objects;
 	vm->objects = object;
+	vm->stats.objectsAllocated++;
+	sampleAllocation(vm, object, type, bytes);
 	return object;
 }
 
-static ObjString* allocateString(std::string chr_string)
+static ObjString* allocateString(VM* vm, std::string chr_string)
 {
-	ObjString* stringObj = new ObjString(chr_string);
-	allocateObject((Obj*)stringObj, OBJ_STRING);
-	VM* vm = currentVM();
-	vm->strings.emplace(std::make_pair(stringObj->string, stringObj));
+	ObjString* stringObj = new (ALLOCATE(vm, HEAP_STRING, ObjString, 1)) ObjString(chr_string);
+	allocateObject(vm, (Obj*)stringObj, OBJ_STRING, sizeof(ObjString) + stringHeapBytes(stringObj->string));
+	vm->stats.stringsAllocated++;
+	accountHeap(vm, HEAP_STRING, stringHeapBytes(stringObj->string));
+	auto entry = vm->strings.emplace(std::make_pair(stringObj->string, stringObj));
+	accountHeap(vm, HEAP_INTERN, INTERN_ENTRY_BYTES + stringHeapBytes(entry.first->first));
 	return stringObj;
 }
 
-ObjString* takeString(std::string chr_string)
+ObjFunction* newFunction(VM* vm)
+{
+	ObjFunction* function = new (ALLOCATE(vm, HEAP_FUNCTION, ObjFunction, 1)) ObjFunction();
+	allocateObject(vm, (Obj*)function, OBJ_FUNCTION, sizeof(ObjFunction));
+	function->arity = 0;
+	function->name = nullptr;
+	function->line = 0;
+	function->compiled = false;
+	function->module = nullptr;
+	return function;
+}
+
+ObjNative* newNative(VM* vm, const char* name, int arity, NativeFn function)
+{
+	ObjNative* native = new (ALLOCATE(vm, HEAP_FUNCTION, ObjNative, 1)) ObjNative();
+	allocateObject(vm, (Obj*)native, OBJ_NATIVE, sizeof(ObjNative));
+	native->function = function;
+	native->name = name;
+	native->arity = arity;
+	return native;
+}
+
+ObjCoroutine* newCoroutine(VM* vm, ObjFunction* function, int argCount, Value* args)
+{
+	ObjCoroutine* coroutine = new (ALLOCATE(vm, HEAP_COROUTINE, ObjCoroutine, 1)) ObjCoroutine();
+	coroutine->state = COROUTINE_SUSPENDED;
+	coroutine->resumer = nullptr;
+	coroutine->body = function;
+	coroutine->function = function;
+	coroutine->chunk = &function->chunk;
+	coroutine->ip = function->chunk.code.data();
+	coroutine->slots = 0;
+	// frames swap with vm->frames, which must never reallocate under a running frame
+	coroutine->frames.reserve(FRAMES_MAX);
+	coroutine->stack.push_back(createObject((Obj*)function));
+	coroutine->stack.insert(coroutine->stack.end(), args, args + argCount);
+	coroutine->stackBytes = 0;
+	accountStack(vm, coroutine->stack, coroutine->frames, &coroutine->stackBytes);
+	allocateObject(vm, (Obj*)coroutine, OBJ_COROUTINE, sizeof(ObjCoroutine) + coroutine->stackBytes);
+	return coroutine;
+}
+
+ObjChannel* newChannelObject(VM* vm, std::shared_ptr<Channel> channel)
+{
+	ObjChannel* object = new (ALLOCATE(vm, HEAP_TASK, ObjChannel, 1)) ObjChannel();
+	allocateObject(vm, (Obj*)object, OBJ_CHANNEL, sizeof(ObjChannel));
+	object->channel = std::move(channel);
+	return object;
+}
+
+ObjTask* newTask(VM* vm)
+{
+	ObjTask* task = new (ALLOCATE(vm, HEAP_TASK, ObjTask, 1)) ObjTask();
+	allocateObject(vm, (Obj*)task, OBJ_TASK, sizeof(ObjTask));
+	task->result.kind = Message::MESSAGE_NIL;
+	task->failed = false;
+	task->finished = false;
+	task->joined = false;
+	return task;
+}
+
+ObjString* takeString(VM* vm, std::string chr_string)
 {
-	VM* vm = currentVM();
 	auto val = vm->strings.find(chr_string);
 	if (val != vm->strings.end())
 		return val->second;
-	return allocateString(chr_string);
+	return allocateString(vm, chr_string);
 }
 
-ObjString* copyString(const char* chars, int length)
+ObjString* copyString(VM* vm, const char* chars, int length)
 {
 	std::string chr_string(chars, length);
-	VM* vm = currentVM();
 	auto val = vm->strings.find(chr_string);
 	if (val != vm->strings.end())
 		return val->second;
-	return allocateString(chr_string);
+	return allocateString(vm, chr_string);
+}
+
+const char* objTypeName(ObjType type)
+{
+	switch (type)
+	{
+	case OBJ_STRING: return "string";
+	case OBJ_FUNCTION: return "function";
+	case OBJ_NATIVE: return "native";
+	case OBJ_COROUTINE: return "coroutine";
+	case OBJ_CHANNEL: return "channel";
+	case OBJ_TASK: return "task";
+	}
+	return "object";
 }
 
 void printObject(Value value)
+{
+	printObject(stdout, value);
+}
+
+void printObject(FILE* file, Value value)
 {
 	switch (OBJ_TYPE(value))
 	{
-	case OBJ_STRING: printf("%s", AS_CSTRING(value)); break;
+	case OBJ_STRING: fputs(AS_CSTRING(value), file); break;
+	case OBJ_FUNCTION: fprintf(file, "<fn %s>", AS_FUNCTION(value)->name->string.c_str()); break;
+	case OBJ_NATIVE: fprintf(file, "<native fn %s>", AS_NATIVE(value)->name); break;
+	case OBJ_COROUTINE: fprintf(file, "<coroutine %s>", AS_COROUTINE(value)->body->name->string.c_str()); break;
+	case OBJ_CHANNEL: fputs("<channel>", file); break;
+	case OBJ_TASK: fputs("<task>", file); break;
 	}
 }
\ No newline at end of file
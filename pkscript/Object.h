@@ -1,11 +1,22 @@
 #pragma once
 
 #include "pkscript.h"
+#include "Chunk.h"
 #include "Value.h"
+#include "VM.h"
+#include "Channel.h"
+
+#include <atomic>
+#include <thread>
 
 enum ObjType
 {
 	OBJ_STRING,
+	OBJ_FUNCTION,
+	OBJ_NATIVE,
+	OBJ_COROUTINE,
+	OBJ_CHANNEL,
+	OBJ_TASK,
 };
 
 struct Obj
@@ -23,10 +34,94 @@ struct ObjString
 		: string(chr_string) {}
 };
 
-ObjString* takeString(std::string chr_string);
-ObjString* copyString(const char* chars, int length);
+struct Module;
+
+struct ObjFunction
+{
+	Obj obj;
+	int arity;
+	Chunk chunk;
+	ObjString* name;
+	// parameter list and body text, kept until the first call compiles it into chunk
+	std::string source;
+	int line;
+	bool compiled;
+	// set when this function is the top level of an imported module
+	Module* module;
+};
+
+// Returns false after reporting a runtime error; otherwise the call evaluates to *result.
+typedef bool (*NativeFn)(VM* vm, int argCount, Value* args, Value* result);
+
+struct ObjNative
+{
+	Obj obj;
+	NativeFn function;
+	const char* name;
+	// -1 takes any number of arguments
+	int arity;
+};
+
+enum CoroutineState
+{
+	COROUTINE_SUSPENDED,
+	COROUTINE_RUNNING,
+	COROUTINE_DONE
+};
+
+// A coroutine keeps its own call frames and operand stack. While it is suspended the
+// fields below hold its state; while it runs they hold the state of whoever resumed it.
+// Switching swaps them with the VM's registers, so no stack is ever copied.
+struct ObjCoroutine
+{
+	Obj obj;
+	CoroutineState state;
+	ObjCoroutine* resumer;
+	// what the coroutine was created to run
+	ObjFunction* body;
+	ObjFunction* function;
+	Chunk* chunk;
+	uint8_t* ip;
+	size_t slots;
+	std::vector<CallFrame> frames;
+	ValueArray stack;
+	// what frames and stack are charged to HEAP_STACK for
+	size_t stackBytes;
+};
+
+// One VM's handle on a channel; other VMs hold their own handles on the same Channel.
+struct ObjChannel
+{
+	Obj obj;
+	std::shared_ptr<Channel> channel;
+};
+
+// A function or script running in a child VM on a thread of its own.
+struct ObjTask
+{
+	Obj obj;
+	std::thread thread;
+	// written by the child before it exits, read after join()
+	Message result;
+	bool failed;
+	// set by the child once the result is written, so join() can tell it will not block
+	std::atomic<bool> finished;
+	bool joined;
+};
+
+ObjFunction* newFunction(VM* vm);
+ObjNative* newNative(VM* vm, const char* name, int arity, NativeFn function);
+// Ready to call `function` with the arguments in args[0 .. argCount - 1] on its first resume.
+ObjCoroutine* newCoroutine(VM* vm, ObjFunction* function, int argCount, Value* args);
+ObjChannel* newChannelObject(VM* vm, std::shared_ptr<Channel> channel);
+ObjTask* newTask(VM* vm);
+ObjString* takeString(VM* vm, std::string chr_string);
+ObjString* copyString(VM* vm, const char* chars, int length);
+
+const char* objTypeName(ObjType type);
 
 void printObject(Value value);
+void printObject(FILE* file, Value value);
 
 static inline bool isObjType(Value value, ObjType type)
 {
@@ -36,6 +131,16 @@ static inline bool isObjType(Value value, ObjType type)
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
+#define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
+#define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
+#define IS_COROUTINE(value) isObjType(value, OBJ_COROUTINE)
+#define IS_CHANNEL(value) isObjType(value, OBJ_CHANNEL)
+#define IS_TASK(value) isObjType(value, OBJ_TASK)
 
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
+#define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
+#define AS_NATIVE(value) ((ObjNative*)AS_OBJ(value))
+#define AS_COROUTINE(value) ((ObjCoroutine*)AS_OBJ(value))
+#define AS_CHANNEL(value) ((ObjChannel*)AS_OBJ(value))
+#define AS_TASK(value) ((ObjTask*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->string.c_str())
\ No newline at end of file
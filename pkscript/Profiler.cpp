@@ -0,0 +1,149 @@
+#include "pkscript.h"
+#include "Profiler.h"
+#include "Debug.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICK_UNIT "cycles"
+static inline uint64_t readTicks()
+{
+	return __rdtsc();
+}
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define TICK_UNIT "cycles"
+static inline uint64_t readTicks()
+{
+	return __rdtsc();
+}
+#else
+#define TICK_UNIT "ns"
+static inline uint64_t readTicks()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+static const uint8_t NO_INSTRUCTION = OP_COUNT;
+
+void initOpProfile(OpProfile* profile)
+{
+	memset(profile, 0, sizeof(OpProfile));
+	profile->previous = NO_INSTRUCTION;
+}
+
+void profileInstruction(OpProfile* profile, uint8_t instruction)
+{
+	uint64_t now = readTicks();
+	if (instruction >= OP_COUNT) return;
+
+	if (profile->previous != NO_INSTRUCTION)
+	{
+		profile->ticks[profile->previous] += now - profile->started;
+		profile->pairs[profile->previous][instruction]++;
+	}
+	profile->counts[instruction]++;
+	profile->previous = instruction;
+	profile->started = now;
+}
+
+struct PairCount
+{
+	uint8_t first;
+	uint8_t second;
+	uint64_t count;
+};
+
+static std::vector<uint8_t> sortedOps(OpProfile* profile)
+{
+	std::vector<uint8_t> ops;
+	for (int op = 0; op < OP_COUNT; op++)
+	{
+		if (profile->counts[op] > 0) ops.push_back((uint8_t)op);
+	}
+	std::sort(ops.begin(), ops.end(), [profile](uint8_t a, uint8_t b)
+	{
+		return profile->ticks[a] > profile->ticks[b];
+	});
+	return ops;
+}
+
+static std::vector<PairCount> sortedPairs(OpProfile* profile)
+{
+	std::vector<PairCount> pairs;
+	for (int a = 0; a < OP_COUNT; a++)
+	{
+		for (int b = 0; b < OP_COUNT; b++)
+		{
+			if (profile->pairs[a][b] > 0) pairs.push_back({ (uint8_t)a, (uint8_t)b, profile->pairs[a][b] });
+		}
+	}
+	std::sort(pairs.begin(), pairs.end(), [](const PairCount& a, const PairCount& b)
+	{
+		return a.count > b.count;
+	});
+	return pairs;
+}
+
+void printOpProfile(OpProfile* profile, FILE* out)
+{
+	uint64_t totalCount = 0;
+	uint64_t totalTicks = 0;
+	for (int op = 0; op < OP_COUNT; op++)
+	{
+		totalCount += profile->counts[op];
+		totalTicks += profile->ticks[op];
+	}
+	if (totalCount == 0) totalCount = 1;
+	if (totalTicks == 0) totalTicks = 1;
+
+	fprintf(out, "== opcode profile ==\n");
+	fprintf(out, "%-20s %14s %7s %16s %7s %10s\n", "opcode", "count", "count%", TICK_UNIT, "time%", "per op");
+	for (uint8_t op : sortedOps(profile))
+	{
+		fprintf(out, "%-20s %14llu %6.2f%% %16llu %6.2f%% %10.1f\n", opcodeName(op),
+			(unsigned long long)profile->counts[op], 100.0 * profile->counts[op] / totalCount,
+			(unsigned long long)profile->ticks[op], 100.0 * profile->ticks[op] / totalTicks,
+			(double)profile->ticks[op] / profile->counts[op]);
+	}
+
+	std::vector<PairCount> pairs = sortedPairs(profile);
+	if (pairs.size() > 20) pairs.resize(20);
+	fprintf(out, "== top opcode pairs ==\n");
+	for (PairCount& pair : pairs)
+	{
+		fprintf(out, "%-20s -> %-20s %14llu\n", opcodeName(pair.first), opcodeName(pair.second),
+			(unsigned long long)pair.count);
+	}
+}
+
+bool writeOpProfileJson(OpProfile* profile, const std::string& path)
+{
+	FILE* out = fopen(path.c_str(), "w");
+	if (out == nullptr) return false;
+
+	fprintf(out, "{\n  \"unit\": \"%s\",\n  \"opcodes\": [", TICK_UNIT);
+	bool first = true;
+	for (uint8_t op : sortedOps(profile))
+	{
+		fprintf(out, "%s\n    {\"op\": \"%s\", \"count\": %llu, \"ticks\": %llu}", first ? "" : ",",
+			opcodeName(op), (unsigned long long)profile->counts[op], (unsigned long long)profile->ticks[op]);
+		first = false;
+	}
+	fprintf(out, "\n  ],\n  \"pairs\": [");
+	first = true;
+	for (PairCount& pair : sortedPairs(profile))
+	{
+		fprintf(out, "%s\n    {\"first\": \"%s\", \"second\": \"%s\", \"count\": %llu}", first ? "" : ",",
+			opcodeName(pair.first), opcodeName(pair.second), (unsigned long long)pair.count);
+		first = false;
+	}
+	fprintf(out, "\n  ]\n}\n");
+	return fclose(out) == 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Chunk.h"
+
+#include <stdint.h>
+#include <string>
+
+// Per-opcode execution counts and time for --profile-ops. Time is attributed to an
+// instruction when the next one starts, in TSC cycles on x86 and nanoseconds elsewhere.
+// run() only calls into this when the build defines PROFILE_OPS.
+struct OpProfile
+{
+	uint64_t counts[OP_COUNT];
+	uint64_t ticks[OP_COUNT];
+	// pairs[a][b] counts b executing right after a, for finding superinstruction candidates
+	uint64_t pairs[OP_COUNT][OP_COUNT];
+	uint64_t started;
+	uint8_t previous;
+};
+
+void initOpProfile(OpProfile* profile);
+
+void profileInstruction(OpProfile* profile, uint8_t instruction);
+
+void printOpProfile(OpProfile* profile, FILE* out);
+
+bool writeOpProfileJson(OpProfile* profile, const std::string& path);
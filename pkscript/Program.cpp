@@ -0,0 +1,77 @@
+#include "pkscript.h"
+#include "Program.h"
+#include "Compiler.h"
+#include "Memory.h"
+#include "Object.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Compiles every function reachable from the chunk's constants, so no VM ever has to
+// write to a shared ObjFunction to compile it lazily.
+static bool compileFunctions(VM* heap, Chunk* chunk)
+{
+	for (Value& value : chunk->constants)
+	{
+		if (!IS_FUNCTION(value)) continue;
+		ObjFunction* function = AS_FUNCTION(value);
+		if (!function->compiled && !compileFunction(heap, function)) return false;
+		if (!compileFunctions(heap, &function->chunk)) return false;
+	}
+	return true;
+}
+
+Program* compileProgram(Source* source)
+{
+	Program* program = new Program();
+	program->heap = createVM();
+	program->refs = 1;
+	if (!compile(&program->heap, source, &program->chunk) || !compileFunctions(&program->heap, &program->chunk))
+	{
+		freeProgram(program);
+		return nullptr;
+	}
+	return program;
+}
+
+Program* compileProgram(const char* source)
+{
+	Source text;
+	sourceFromString(&text, source, strlen(source));
+	return compileProgram(&text);
+}
+
+void freeProgram(Program* program)
+{
+	if (program->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+	freeVM(&program->heap);
+	delete program;
+}
+
+void forgetPrograms(VM* vm)
+{
+	for (Program* program : vm->programs) freeProgram(program);
+	vm->programs.clear();
+}
+
+void start(VM* vm, Program* program)
+{
+	if (std::find(vm->programs.begin(), vm->programs.end(), program) == vm->programs.end())
+	{
+		// a string the VM interned first keeps its own object: values already hold it
+		for (auto& entry : program->heap.strings)
+		{
+			auto seeded = vm->strings.try_emplace(entry.first, entry.second);
+			if (seeded.second) accountHeap(vm, HEAP_INTERN, INTERN_ENTRY_BYTES + stringHeapBytes(seeded.first->first));
+		}
+		program->refs.fetch_add(1, std::memory_order_relaxed);
+		vm->programs.push_back(program);
+	}
+	start(vm, &program->chunk);
+}
+
+InterpretResult interpret(VM* vm, Program* program)
+{
+	start(vm, program);
+	return resume(vm, 0);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Chunk.h"
+#include "Source.h"
+#include "VM.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// A script compiled once and then run by any number of VMs, on any threads. Every
+// function body is compiled up front and nothing in a Program is written after
+// compileProgram() returns, so VMs can share it without locking. The objects behind
+// its constants live in the program's own heap. Each VM that runs it gets the strings
+// it has not interned yet seeded into its intern table, so strings the VM builds at
+// run time are mostly the program's own objects; the rest still compare equal by text.
+// A VM that ran the program holds a reference to it until freeVM(), so those strings
+// outlive every VM whose intern table points at them.
+struct Program
+{
+	Chunk chunk;
+	VM heap;
+	// one for the compileProgram() caller and one per VM that has run it
+	std::atomic<int> refs;
+};
+
+// Returns nullptr if the script or any of its functions fails to compile.
+Program* compileProgram(Source* source);
+Program* compileProgram(const char* source);
+
+// Drops the caller's reference. The program itself goes once the last VM that ran it
+// has been freed too, on whichever thread frees that VM.
+void freeProgram(Program* program);
+
+// Drops the references `vm` holds on the programs it ran, for freeVM() on the VM's own
+// thread. Nothing else ever touches a VM's tables.
+void forgetPrograms(VM* vm);
+
+// Runs the program's top level in `vm`, which keeps its own stack and globals.
+InterpretResult interpret(VM* vm, Program* program);
+
+// Like start(VM*, Chunk*): the program's top level runs with resume().
+void start(VM* vm, Program* program);
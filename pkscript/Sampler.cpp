@@ -0,0 +1,332 @@
+#include "pkscript.h"
+#include "Sampler.h"
+#include "Object.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+// older glibc only has the raw union member
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+struct SampleFrame
+{
+	ObjFunction* function;
+	int line;
+};
+
+struct SampleStack
+{
+	uint64_t hash;
+	uint64_t count;
+	uint32_t start;
+	uint32_t depth;
+};
+
+// Everything the handler touches for one thread. Only that thread's own timer signals
+// it, so the handler needs no lock.
+struct ThreadSamples
+{
+	VM* vm;
+	SampleStack* stacks;
+	uint32_t stackCount;
+	SampleFrame* frames;
+	uint32_t frameCount;
+	uint32_t framesUsed;
+	uint64_t dropped;
+#ifdef __linux__
+	timer_t timer;
+#endif
+};
+
+static thread_local ThreadSamples* threadSamples = nullptr;
+
+static std::atomic<bool> sampling(false);
+static long sampleInterval = 0;
+
+// finished threads' samples, with the function names resolved while they still existed
+static std::mutex foldedLock;
+static std::unordered_map<std::string, uint64_t> folded;
+static uint64_t dropped = 0;
+static bool sampled = false;
+
+static bool frameAt(Chunk* chunk, uint8_t* ip, ObjFunction* function, SampleFrame* frame)
+{
+	if (chunk == nullptr || ip == nullptr) return false;
+	uint8_t* code = chunk->code.data();
+	// the registers can be caught halfway through a call or return
+	if (ip < code || ip > code + chunk->code.size()) return false;
+
+	frame->function = function;
+	frame->line = getLine(chunk, ip > code ? (size_t)(ip - code - 1) : 0);
+	return true;
+}
+
+// Appends `frames` and then the running frame, outermost first as the folded format expects.
+static bool addFrames(SampleFrame* stack, uint32_t* depth, std::vector<CallFrame>& frames,
+	ObjFunction* function, Chunk* chunk, uint8_t* ip)
+{
+	size_t count = frames.size();
+	if (count >= FRAMES_MAX + 1 - *depth) return false;
+	for (size_t i = 0; i < count; i++)
+	{
+		CallFrame& frame = frames[i];
+		if (!frameAt(frame.chunk, frame.ip, frame.function, &stack[*depth])) return false;
+		(*depth)++;
+	}
+	if (!frameAt(chunk, ip, function, &stack[*depth])) return false;
+	(*depth)++;
+	return true;
+}
+
+static uint64_t hashStack(SampleFrame* stack, uint32_t depth)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (uint32_t i = 0; i < depth; i++)
+	{
+		hash = (hash ^ (uint64_t)(uintptr_t)stack[i].function) * 1099511628211ULL;
+		hash = (hash ^ (uint64_t)(uint32_t)stack[i].line) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void recordStack(ThreadSamples* samples, SampleFrame* stack, uint32_t depth)
+{
+	uint64_t hash = hashStack(stack, depth);
+	for (uint32_t probe = 0; probe < samples->stackCount; probe++)
+	{
+		SampleStack* entry = &samples->stacks[(hash + probe) & (samples->stackCount - 1)];
+		if (entry->count == 0)
+		{
+			if (samples->framesUsed + depth > samples->frameCount) break;
+			memcpy(samples->frames + samples->framesUsed, stack, depth * sizeof(SampleFrame));
+			entry->hash = hash;
+			entry->start = samples->framesUsed;
+			entry->depth = depth;
+			entry->count = 1;
+			samples->framesUsed += depth;
+			return;
+		}
+		if (entry->hash == hash && entry->depth == depth
+			&& memcmp(samples->frames + entry->start, stack, depth * sizeof(SampleFrame)) == 0)
+		{
+			entry->count++;
+			return;
+		}
+	}
+	samples->dropped++;
+}
+
+#ifndef _WIN32
+static void handleSample(int)
+{
+	ThreadSamples* samples = threadSamples;
+	if (samples == nullptr) return;
+	VM* vm = samples->vm;
+
+	// stacks are compared with memcmp, so the padding must not hold garbage
+	SampleFrame stack[FRAMES_MAX + 1];
+	memset(stack, 0, sizeof(stack));
+	uint32_t depth = 0;
+
+	// each running coroutine holds the frames of whoever resumed it, the outermost last
+	ObjCoroutine* chain[SAMPLE_COROUTINES];
+	int links = 0;
+	for (ObjCoroutine* coroutine = vm->coroutine; coroutine != nullptr; coroutine = coroutine->resumer)
+	{
+		if (links == SAMPLE_COROUTINES)
+		{
+			samples->dropped++;
+			return;
+		}
+		chain[links++] = coroutine;
+	}
+	for (int i = links - 1; i >= 0; i--)
+	{
+		ObjCoroutine* coroutine = chain[i];
+		if (!addFrames(stack, &depth, coroutine->frames, coroutine->function, coroutine->chunk, coroutine->ip))
+		{
+			samples->dropped++;
+			return;
+		}
+	}
+	if (!addFrames(stack, &depth, vm->frames, vm->function, vm->chunk, vm->ip))
+	{
+		samples->dropped++;
+		return;
+	}
+
+	recordStack(samples, stack, depth);
+}
+#endif
+
+static ThreadSamples* newThreadSamples(VM* vm, uint32_t stackCount, uint32_t frameCount)
+{
+	ThreadSamples* samples = new ThreadSamples();
+	samples->vm = vm;
+	samples->stacks = new SampleStack[stackCount]();
+	samples->stackCount = stackCount;
+	samples->frames = new SampleFrame[frameCount];
+	samples->frameCount = frameCount;
+	return samples;
+}
+
+// Module names are file paths, which may contain the separators of the folded format.
+static void appendFrameName(std::string* out, const char* name)
+{
+	for (; *name != '\0'; name++)
+	{
+		out->push_back(*name == ';' || *name == ' ' ? '_' : *name);
+	}
+}
+
+// Turns the thread's stacks into text while its functions are still alive.
+static void foldSamples(ThreadSamples* samples)
+{
+	std::lock_guard<std::mutex> guard(foldedLock);
+	for (uint32_t i = 0; i < samples->stackCount; i++)
+	{
+		SampleStack& entry = samples->stacks[i];
+		if (entry.count == 0) continue;
+		std::string key;
+		for (uint32_t j = 0; j < entry.depth; j++)
+		{
+			SampleFrame& frame = samples->frames[entry.start + j];
+			if (j > 0) key.push_back(';');
+			appendFrameName(&key, frame.function == nullptr ? "script" : frame.function->name->string.c_str());
+			key += ":" + std::to_string(frame.line);
+		}
+		folded[key] += entry.count;
+	}
+	dropped += samples->dropped;
+	delete[] samples->stacks;
+	delete[] samples->frames;
+	delete samples;
+}
+
+// Arms a timer for the calling thread.
+static bool startThread(ThreadSamples* samples)
+{
+#ifdef __linux__
+	sigevent event = {};
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &samples->timer) != 0) return false;
+
+	itimerspec timer = {};
+	timer.it_interval.tv_sec = sampleInterval / 1000000;
+	timer.it_interval.tv_nsec = sampleInterval % 1000000 * 1000;
+	timer.it_value = timer.it_interval;
+	threadSamples = samples;
+	if (timer_settime(samples->timer, 0, &timer, nullptr) == 0) return true;
+	threadSamples = nullptr;
+	timer_delete(samples->timer);
+	return false;
+#elif !defined(_WIN32)
+	threadSamples = samples;
+	itimerval timer = {};
+	timer.it_interval.tv_sec = sampleInterval / 1000000;
+	timer.it_interval.tv_usec = sampleInterval % 1000000;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, nullptr) == 0) return true;
+	threadSamples = nullptr;
+	return false;
+#else
+	return false;
+#endif
+}
+
+static void stopThread()
+{
+	ThreadSamples* samples = threadSamples;
+	if (samples == nullptr) return;
+	// a tick already on its way finds nothing to write to
+	threadSamples = nullptr;
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+#ifdef __linux__
+	timer_delete(samples->timer);
+#elif !defined(_WIN32)
+	itimerval timer = {};
+	setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+	foldSamples(samples);
+}
+
+#ifndef _WIN32
+bool startSampler(VM* vm, int hz)
+{
+	struct sigaction action = {};
+	action.sa_handler = handleSample;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, nullptr) != 0) return false;
+
+	sampleInterval = 1000000 / (hz > 0 ? hz : SAMPLE_HZ);
+	ThreadSamples* samples = newThreadSamples(vm, SAMPLE_STACKS, SAMPLE_FRAMES);
+	if (!startThread(samples))
+	{
+		foldSamples(samples);
+		return false;
+	}
+	sampled = true;
+	sampling = true;
+	return true;
+}
+#else
+bool startSampler(VM*, int)
+{
+	return false;
+}
+#endif
+
+void stopSampler()
+{
+	sampling = false;
+	stopThread();
+}
+
+#ifdef __linux__
+void sampleThread(VM* vm)
+{
+	if (!sampling) return;
+	ThreadSamples* samples = newThreadSamples(vm, SAMPLE_TASK_STACKS, SAMPLE_TASK_FRAMES);
+	if (!startThread(samples)) foldSamples(samples);
+}
+#else
+// the process-wide timer can't be aimed at another thread
+void sampleThread(VM*) {}
+#endif
+
+void unsampleThread()
+{
+	stopThread();
+}
+
+bool writeSamples(const std::string& path)
+{
+	if (!sampled) return false;
+	FILE* out = fopen(path.c_str(), "w");
+	if (out == nullptr) return false;
+
+	std::lock_guard<std::mutex> guard(foldedLock);
+	for (auto& entry : folded)
+	{
+		fprintf(out, "%s %llu\n", entry.first.c_str(), (unsigned long long)entry.second);
+	}
+	if (dropped > 0) fprintf(out, "[dropped] %llu\n", (unsigned long long)dropped);
+	return fclose(out) == 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "VM.h"
+
+#include <string>
+
+// Statistical line profiler for --profile-lines. A SIGPROF timer interrupts the thread
+// running `vm` and the handler records the call stack as (function, line) pairs, read
+// straight from the VM registers and frames. Identical stacks are counted in a fixed
+// size table per thread, so memory stays bounded however long the script runs.
+//
+// On Linux every sampled thread gets a timer of its own that counts that thread's CPU
+// time, so tasks spawned while the sampler runs are profiled too. Elsewhere a single
+// process-wide timer samples only the thread that started the sampler; ticks that land
+// on other threads are lost.
+#define SAMPLE_HZ 1000
+#define SAMPLE_STACKS (1 << 16)
+#define SAMPLE_FRAMES (1 << 20)
+// a spawned task gets smaller tables, since many may run at once
+#define SAMPLE_TASK_STACKS (1 << 10)
+#define SAMPLE_TASK_FRAMES (1 << 14)
+// running coroutines nested deeper than this are not sampled
+#define SAMPLE_COROUTINES 16
+
+bool startSampler(VM* vm, int hz = SAMPLE_HZ);
+
+void stopSampler();
+
+// While the sampler runs, also samples `vm` on the calling thread; a no-op otherwise.
+// unsampleThread() stops that again and must run before the VM's objects are freed.
+void sampleThread(VM* vm);
+
+void unsampleThread();
+
+// Writes the samples in folded stack format ("script:3;fib:1;fib:1 42" per line), as
+// read by flamegraph.pl and speedscope, plus a "[dropped] n" line for samples that
+// could not be recorded. Tasks still running by then are left out.
+bool writeSamples(const std::string& path);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Source.h"
+
 enum TokenType
 {
 	TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
@@ -15,9 +17,9 @@ enum TokenType
 	TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
 	// Keywords.
 	TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
-	TOKEN_FOR, TOKEN_FUNC, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
-	TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
-	TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
+	TOKEN_FOR, TOKEN_FUNC, TOKEN_IF, TOKEN_IMPORT, TOKEN_NIL, TOKEN_OR,
+	TOKEN_PRINT, TOKEN_RESUME, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
+	TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE, TOKEN_YIELD,
 
 	TOKEN_ERROR, TOKEN_EOF
 };
@@ -30,6 +32,16 @@ struct Token
 	int line;
 };
 
-void initScanner(const char* source);
+// Scanner state is owned by the caller so independent compilations never share it.
+struct Scanner
+{
+	const char* start;
+	const char* current;
+	const char* end;
+	int line;
+	Source* source;
+};
+
+void initScanner(Scanner* scanner, Source* source, int line = 1);
 
-Token scanToken();
\ No newline at end of file
+Token scanToken(Scanner* scanner);
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+struct Scheduler
+{
+	std::mutex lock;
+	std::condition_variable ready;
+	std::condition_variable idle;
+	std::deque<VM*> queue;
+	// scheduled and not finished yet, whether queued or running
+	size_t pending;
+	// queued VMs that are waiting on another thread, and turns in a row that found one
+	size_t retrying;
+	size_t stalls;
+	bool closing;
+	uint64_t slice;
+	ScriptFinished finished;
+	std::vector<std::thread> threads;
+};
+
+static void worker(Scheduler* scheduler)
+{
+	std::unique_lock<std::mutex> lock(scheduler->lock);
+	for (;;)
+	{
+		scheduler->ready.wait(lock, [&]() { return scheduler->closing || !scheduler->queue.empty(); });
+		if (scheduler->queue.empty()) return;
+
+		VM* vm = scheduler->queue.front();
+		scheduler->queue.pop_front();
+		if (vm->retry) scheduler->retrying--;
+		lock.unlock();
+
+		InterpretResult result = resume(vm, scheduler->slice);
+		if (result != INTERPRET_YIELDED) scheduler->finished(vm, result);
+		// another thread may take the VM as soon as it is queued
+		bool retry = result == INTERPRET_YIELDED && vm->retry;
+		int waitFd = retry ? vm->waitFd : -1;
+		bool waitWrite = vm->waitWrite;
+
+		lock.lock();
+		if (result == INTERPRET_YIELDED)
+		{
+			scheduler->queue.push_back(vm);
+			if (!retry)
+			{
+				scheduler->stalls = 0;
+				continue;
+			}
+			// while nothing queued can go ahead either, give the other threads a moment
+			if (++scheduler->retrying != scheduler->queue.size())
+			{
+				scheduler->stalls = 0;
+			}
+			else if (++scheduler->stalls >= RETRY_SPINS * scheduler->queue.size())
+			{
+				if (waitFd >= 0)
+				{
+					// what the VM waits for may well be signalled on this descriptor
+					lock.unlock();
+#ifndef _WIN32
+					pollfd wait = { waitFd, (short)(waitWrite ? POLLOUT : POLLIN), 0 };
+					poll(&wait, 1, RETRY_WAIT_MS);
+#endif
+					lock.lock();
+				}
+				else
+				{
+					scheduler->ready.wait_for(lock, std::chrono::milliseconds(RETRY_WAIT_MS));
+				}
+				scheduler->stalls -= std::min(scheduler->stalls, scheduler->queue.size());
+			}
+			else
+			{
+				lock.unlock();
+				std::this_thread::yield();
+				lock.lock();
+			}
+		}
+		else
+		{
+			scheduler->stalls = 0;
+			if (--scheduler->pending == 0) scheduler->idle.notify_all();
+		}
+	}
+}
+
+Scheduler* newScheduler(unsigned threads, uint64_t slice, ScriptFinished finished)
+{
+	Scheduler* scheduler = new Scheduler;
+	scheduler->pending = 0;
+	scheduler->retrying = 0;
+	scheduler->stalls = 0;
+	scheduler->closing = false;
+	scheduler->slice = slice;
+	scheduler->finished = finished;
+	for (unsigned i = 0; i < threads; i++)
+	{
+		scheduler->threads.emplace_back(worker, scheduler);
+	}
+	return scheduler;
+}
+
+void schedule(Scheduler* scheduler, VM* vm)
+{
+	{
+		std::lock_guard<std::mutex> guard(scheduler->lock);
+		scheduler->queue.push_back(vm);
+		scheduler->pending++;
+	}
+	scheduler->ready.notify_one();
+}
+
+void waitIdle(Scheduler* scheduler)
+{
+	std::unique_lock<std::mutex> lock(scheduler->lock);
+	scheduler->idle.wait(lock, [&]() { return scheduler->pending == 0; });
+}
+
+void freeScheduler(Scheduler* scheduler)
+{
+	waitIdle(scheduler);
+	{
+		std::lock_guard<std::mutex> guard(scheduler->lock);
+		scheduler->closing = true;
+	}
+	scheduler->ready.notify_all();
+	for (std::thread& thread : scheduler->threads)
+	{
+		thread.join();
+	}
+	delete scheduler;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "VM.h"
+
+#include <functional>
+
+// Runs many VMs on a few threads. Each scheduled VM gets a slice of `slice`
+// instructions and then goes to the back of the queue, so a script stuck in a loop
+// only ever holds a thread for one slice and every other script keeps making progress.
+struct Scheduler;
+
+// VMs waiting on other threads (see waitForRetry()): a scheduler that has nothing else
+// spins this many turns per VM and then waits RETRY_WAIT_MS per pass; an event loop
+// retries them every RETRY_WAIT_MS at most.
+#define RETRY_SPINS 64
+#define RETRY_WAIT_MS 1
+
+// Called on the worker thread that ran the VM's last slice, never with INTERPRET_YIELDED.
+using ScriptFinished = std::function<void(VM* vm, InterpretResult result)>;
+
+Scheduler* newScheduler(unsigned threads, uint64_t slice, ScriptFinished finished);
+
+// `vm` must have a script started. It belongs to the scheduler until `finished` runs.
+void schedule(Scheduler* scheduler, VM* vm);
+
+// Blocks until every scheduled VM has finished.
+void waitIdle(Scheduler* scheduler);
+
+// Waits for the scheduled VMs, then stops the threads.
+void freeScheduler(Scheduler* scheduler);
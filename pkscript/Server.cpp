@@ -0,0 +1,313 @@
+#include "pkscript.h"
+#include "Server.h"
+#include "Object.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <unordered_set>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// longest request line a worker reads
+#define REQUEST_MAX (64 * 1024)
+// how long a worker waits on a client that stops sending
+#define REQUEST_TIMEOUT_SECONDS 5
+
+#ifndef _WIN32
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int)
+{
+	stopping = 1;
+}
+
+// The scanner's number grammar: digits, then optionally a dot and more digits.
+static bool isNumber(const std::string& text)
+{
+	size_t i = 0;
+	while (i < text.size() && isdigit((unsigned char)text[i])) i++;
+	if (i == 0) return false;
+	if (i + 1 < text.size() && text[i] == '.' && isdigit((unsigned char)text[i + 1]))
+	{
+		for (i++; i < text.size() && isdigit((unsigned char)text[i]); i++) {}
+	}
+	return i == text.size();
+}
+
+static Value parseArgument(VM* vm, const std::string& text)
+{
+	if (text == "true") return createBool(true);
+	if (text == "false") return createBool(false);
+	if (text == "nil") return createNil();
+	if (isNumber(text)) return createNumber(strtod(text.c_str(), nullptr));
+	return createObject((Obj*)copyString(vm, text.data(), (int)text.size()));
+}
+
+// Nothing collects garbage, so the strings a request allocated (its arguments and any
+// it built) would pile up in a long-lived worker. Frees those nothing else refers to.
+static void freeRequestStrings(VM* vm, Obj* mark)
+{
+	std::unordered_set<Obj*> dead;
+	for (Obj* object = vm->objects; object != mark; object = object->next)
+	{
+		if (object->type == OBJ_STRING) dead.insert(object);
+	}
+	if (dead.empty()) return;
+
+	auto keep = [&](Value value)
+	{
+		if (IS_OBJ(value)) dead.erase(AS_OBJ(value));
+	};
+	for (auto& global : vm->globals) keep(global.second);
+	for (auto& module : vm->modules)
+	{
+		for (auto& exported : module.second.exports) keep(exported.second);
+	}
+	for (Obj* object = vm->objects; object != nullptr && !dead.empty(); object = object->next)
+	{
+		if (object->type == OBJ_FUNCTION)
+		{
+			ObjFunction* function = (ObjFunction*)object;
+			if (function->name != nullptr) dead.erase((Obj*)function->name);
+			for (Value constant : function->chunk.constants) keep(constant);
+		}
+		else if (object->type == OBJ_COROUTINE)
+		{
+			for (Value value : ((ObjCoroutine*)object)->stack) keep(value);
+		}
+	}
+	freeStrings(vm, dead);
+}
+
+static bool readRequest(int client, std::string* line)
+{
+	char buffer[4096];
+	while (line->size() < REQUEST_MAX)
+	{
+		ssize_t count = read(client, buffer, sizeof(buffer));
+		if (count < 0 && errno == EINTR) continue;
+		if (count <= 0) return count == 0;
+		line->append(buffer, (size_t)count);
+		size_t newline = line->find('\n');
+		if (newline != std::string::npos)
+		{
+			line->resize(newline);
+			if (!line->empty() && line->back() == '\r') line->pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+static void writeAll(int client, const char* data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t count = write(client, data, size);
+		if (count < 0 && errno == EINTR) continue;
+		if (count <= 0) return;
+		data += count;
+		size -= (size_t)count;
+	}
+}
+
+static void handleRequest(VM* vm, Value entry, int client)
+{
+	std::string text;
+	if (!readRequest(client, &text))
+	{
+		static const char reply[] = "error\nRequest too long or cut off.\n";
+		writeAll(client, reply, sizeof(reply) - 1);
+		return;
+	}
+
+	Obj* mark = vm->objects;
+	// the same stub spawn() uses: push the callee and the arguments, call, return
+	int line = IS_FUNCTION(entry) ? AS_FUNCTION(entry)->line : 0;
+	Chunk call;
+	writeConstant(&call, entry, line);
+	int argCount = 0;
+	for (size_t start = 0; !text.empty() && start <= text.size(); argCount++)
+	{
+		size_t tab = text.find('\t', start);
+		if (tab == std::string::npos) tab = text.size();
+		writeConstant(&call, parseArgument(vm, text.substr(start, tab - start)), line);
+		start = tab + 1;
+	}
+	if (argCount > 255)
+	{
+		static const char reply[] = "error\nCan't pass more than 255 arguments.\n";
+		writeAll(client, reply, sizeof(reply) - 1);
+		freeRequestStrings(vm, mark);
+		return;
+	}
+	writeChunk(&call, OP_CALL, line);
+	writeChunk(&call, (uint8_t)argCount, line);
+	writeChunk(&call, OP_RETURN, line);
+
+	char* data = nullptr;
+	size_t size = 0;
+	FILE* output = open_memstream(&data, &size);
+	if (output == nullptr) return;
+	vm->out = vm->err = output;
+	startScript(vm, &call);
+	InterpretResult result = resume(vm, 0);
+	if (result == INTERPRET_OK)
+	{
+		printValue(output, vm->stack.back());
+		fputc('\n', output);
+	}
+	fclose(output);
+	vm->out = stdout;
+	vm->err = stderr;
+	vm->stack.clear();
+	freeRequestStrings(vm, mark);
+
+	const char* status = result == INTERPRET_OK ? "ok\n" : "error\n";
+	writeAll(client, status, strlen(status));
+	writeAll(client, data, size);
+	free(data);
+}
+
+static void runWorker(VM* vm, Value entry, int listener, uint64_t maxRequests)
+{
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	// a client that hangs up early must not take the worker with it
+	signal(SIGPIPE, SIG_IGN);
+
+	uint64_t served = 0;
+	while (maxRequests == 0 || served < maxRequests)
+	{
+		int client = accept(listener, nullptr, nullptr);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			_exit(74);
+		}
+		timeval timeout = { REQUEST_TIMEOUT_SECONDS, 0 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		handleRequest(vm, entry, client);
+		close(client);
+		served++;
+	}
+	_exit(0);
+}
+
+static pid_t forkWorker(VM* vm, Value entry, int listener, uint64_t maxRequests)
+{
+	pid_t pid = fork();
+	if (pid == 0) runWorker(vm, entry, listener, maxRequests);
+	return pid;
+}
+
+int serve(VM* vm, const std::string& socketPath, const ServeOptions& options)
+{
+	auto found = vm->globals.find(options.entry);
+	if (found == vm->globals.end() || !(IS_FUNCTION(found->second) || IS_NATIVE(found->second)))
+	{
+		fprintf(vm->err, "There is no function '%s' to serve.\n", options.entry.c_str());
+		return 70;
+	}
+	Value entry = found->second;
+
+	sockaddr_un address;
+	if (socketPath.size() >= sizeof(address.sun_path))
+	{
+		fprintf(vm->err, "Socket path %s is too long.\n", socketPath.c_str());
+		return 64;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, socketPath.data(), socketPath.size());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	unlink(socketPath.c_str());
+	if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+	{
+		fprintf(vm->err, "Could not listen on %s: %s.\n", socketPath.c_str(), strerror(errno));
+		if (listener >= 0) close(listener);
+		return 74;
+	}
+
+	// no SA_RESTART, so a signal breaks the parent out of waitpid()
+	struct sigaction action = {};
+	action.sa_handler = stop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	// anything buffered now would otherwise be written once by every worker
+	fflush(nullptr);
+	std::vector<pid_t> workers;
+	int code = 0;
+	for (unsigned i = 0; i < options.workers; i++)
+	{
+		pid_t pid = forkWorker(vm, entry, listener, options.maxRequests);
+		if (pid < 0)
+		{
+			fprintf(vm->err, "Could not start a worker: %s.\n", strerror(errno));
+			code = 71;
+			stopping = 1;
+			break;
+		}
+		workers.push_back(pid);
+	}
+
+	while (!stopping)
+	{
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+		auto worker = std::find(workers.begin(), workers.end(), pid);
+		if (worker == workers.end()) continue;
+		workers.erase(worker);
+		// retired or crashed mid-request: replace it. Any other exit means the socket broke.
+		if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+		{
+			fprintf(vm->err, "A worker failed to accept connections.\n");
+			code = WEXITSTATUS(status);
+			break;
+		}
+		if (WIFSIGNALED(status)) fprintf(vm->err, "A worker died from signal %d.\n", WTERMSIG(status));
+		fflush(nullptr);
+		pid = forkWorker(vm, entry, listener, options.maxRequests);
+		if (pid > 0) workers.push_back(pid);
+		else fprintf(vm->err, "Could not replace a worker: %s.\n", strerror(errno));
+	}
+
+	for (pid_t pid : workers) kill(pid, SIGTERM);
+	for (pid_t pid : workers) waitpid(pid, nullptr, 0);
+	close(listener);
+	unlink(socketPath.c_str());
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	stopping = 0;
+	return code;
+}
+
+#else
+
+int serve(VM* vm, const std::string&, const ServeOptions&)
+{
+	fprintf(vm->err, "--serve needs fork() and Unix sockets, which this platform does not have.\n");
+	return 64;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "VM.h"
+
+#include <string>
+
+// Prefork server. The VM is set up once, by whatever ran in it before serve(), and every
+// worker process is a fork of it, so a request costs a call into a warm heap rather than
+// a read, a compile and a prologue. Workers share the listening socket and take one
+// connection at a time.
+//
+// A request is one line of tab separated arguments. Arguments that read as numbers,
+// true, false or nil become those values and the rest are passed as strings. The reply
+// is "ok" or "error" on a line of its own, then what the call printed, then (on success)
+// the value it returned. The connection closes after the reply.
+struct ServeOptions
+{
+	unsigned workers;
+	// a worker that has served this many requests exits and is replaced by a fresh
+	// fork, which drops whatever its requests left on the heap; 0 never recycles
+	uint64_t maxRequests;
+	// the global each request calls
+	std::string entry;
+};
+
+// Runs until SIGINT or SIGTERM and returns the exit code. POSIX only; elsewhere it
+// reports that and returns 64.
+int serve(VM* vm, const std::string& socketPath, const ServeOptions& options);
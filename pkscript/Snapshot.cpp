@@ -0,0 +1,355 @@
+#include "pkscript.h"
+#include "Snapshot.h"
+#include "Memory.h"
+#include "Object.h"
+
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char PKI_MAGIC[4] = { 'P', 'K', 'I', 0x1A };
+static const uint32_t PKI_BYTE_ORDER = 0x01020304;
+static const uint32_t NO_OBJECT = UINT32_MAX;
+
+struct SnapshotHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t objectCount;
+	uint32_t globalCount;
+	uint32_t reserved;
+	uint64_t dataBytes;
+};
+
+// Everything variable sized lives in the data section after the tables and is found by
+// offset, so the tables have a fixed layout.
+struct SnapshotObject
+{
+	uint8_t type;
+	uint8_t compiled;
+	uint16_t padding;
+	int32_t arity;
+	int32_t line;
+	uint32_t name;
+	uint64_t offset;
+	uint32_t length;
+	uint32_t codeLength;
+	uint32_t lineCount;
+	uint32_t constantCount;
+	uint64_t chunkOffset;
+};
+
+struct SnapshotValue
+{
+	uint8_t type;
+	uint8_t padding[3];
+	// object index, or the boolean
+	uint32_t object;
+	double number;
+};
+
+struct SnapshotGlobal
+{
+	uint64_t nameOffset;
+	uint32_t nameLength;
+	uint32_t padding;
+	SnapshotValue value;
+};
+
+struct SnapshotLine
+{
+	uint32_t offset;
+	int32_t line;
+};
+
+using ObjectIndex = std::unordered_map<Obj*, uint32_t>;
+
+template <typename T>
+static void append(std::string& data, const T& value)
+{
+	data.append((const char*)&value, sizeof(T));
+}
+
+static bool snapshotValue(Value value, const ObjectIndex& index, SnapshotValue* out)
+{
+	memset(out, 0, sizeof(*out));
+	out->type = (uint8_t)value.type;
+	switch (value.type)
+	{
+	case VAL_BOOL: out->object = AS_BOOL(value); return true;
+	case VAL_NIL: return true;
+	case VAL_NUMBER: out->number = AS_NUMBER(value); return true;
+	case VAL_OBJ:
+	{
+		auto found = index.find(AS_OBJ(value));
+		if (found == index.end()) return false;
+		out->object = found->second;
+		return true;
+	}
+	}
+	return false;
+}
+
+// Same scheme as the bytecode cache: a private temporary file, renamed into place.
+static bool writeFile(const std::string& path, const std::string& bytes)
+{
+	std::string temp = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	FILE* file = fopen(temp.c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	written = fclose(file) == 0 && written;
+	if (!written || rename(temp.c_str(), path.c_str()) != 0)
+	{
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool writeSnapshot(VM* vm, const std::string& path, std::string* error)
+{
+	// only what the globals can reach: a setup script leaves plenty of dead strings behind
+	std::vector<Obj*> objects;
+	ObjectIndex index;
+	auto reach = [&](Value value)
+	{
+		if (!IS_OBJ(value)) return;
+		Obj* object = AS_OBJ(value);
+		if (object->type != OBJ_STRING && object->type != OBJ_FUNCTION) return;
+		if (index.emplace(object, (uint32_t)objects.size()).second) objects.push_back(object);
+	};
+	for (auto& global : vm->globals) reach(global.second);
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		if (objects[i]->type != OBJ_FUNCTION) continue;
+		ObjFunction* function = (ObjFunction*)objects[i];
+		if (function->name != nullptr) reach(createObject((Obj*)function->name));
+		for (Value& constant : function->chunk.constants) reach(constant);
+	}
+
+	std::string data;
+	std::vector<SnapshotObject> table;
+	for (Obj* object : objects)
+	{
+		SnapshotObject entry = {};
+		entry.type = (uint8_t)object->type;
+		entry.name = NO_OBJECT;
+		entry.offset = data.size();
+		if (object->type == OBJ_STRING)
+		{
+			ObjString* string = (ObjString*)object;
+			entry.length = (uint32_t)string->string.size();
+			data += string->string;
+		}
+		else
+		{
+			ObjFunction* function = (ObjFunction*)object;
+			entry.compiled = function->compiled;
+			entry.arity = function->arity;
+			entry.line = function->line;
+			if (function->name != nullptr) entry.name = index.at((Obj*)function->name);
+			entry.length = (uint32_t)function->source.size();
+			data += function->source;
+
+			Chunk& chunk = function->chunk;
+			entry.chunkOffset = data.size();
+			entry.codeLength = (uint32_t)chunk.code.size();
+			entry.lineCount = (uint32_t)chunk.lines.size();
+			entry.constantCount = (uint32_t)chunk.constants.size();
+			data.append((const char*)chunk.code.data(), chunk.code.size());
+			for (LineStart& line : chunk.lines) append(data, SnapshotLine{ line.offset, line.line });
+			for (Value& constant : chunk.constants)
+			{
+				SnapshotValue value;
+				if (!snapshotValue(constant, index, &value))
+				{
+					*error = "function '" + function->name->string + "' has a constant that cannot be saved";
+					return false;
+				}
+				append(data, value);
+			}
+		}
+		table.push_back(entry);
+	}
+
+	std::vector<SnapshotGlobal> globals;
+	for (auto& global : vm->globals)
+	{
+		// every VM defines its own natives
+		if (IS_NATIVE(global.second)) continue;
+		SnapshotGlobal entry = {};
+		if (!snapshotValue(global.second, index, &entry.value))
+		{
+			*error = "global '" + global.first + "' holds a " + objTypeName(OBJ_TYPE(global.second))
+				+ ", which cannot be saved";
+			return false;
+		}
+		entry.nameOffset = data.size();
+		entry.nameLength = (uint32_t)global.first.size();
+		data += global.first;
+		globals.push_back(entry);
+	}
+
+	SnapshotHeader header = {};
+	memcpy(header.magic, PKI_MAGIC, sizeof(PKI_MAGIC));
+	header.version = PKI_VERSION;
+	header.byteOrder = PKI_BYTE_ORDER;
+	header.objectCount = (uint32_t)table.size();
+	header.globalCount = (uint32_t)globals.size();
+	header.dataBytes = data.size();
+
+	std::string bytes;
+	append(bytes, header);
+	bytes.append((const char*)table.data(), table.size() * sizeof(SnapshotObject));
+	bytes.append((const char*)globals.data(), globals.size() * sizeof(SnapshotGlobal));
+	bytes += data;
+	if (!writeFile(path, bytes))
+	{
+		*error = "could not write " + path;
+		return false;
+	}
+	return true;
+}
+
+static bool restoreValue(const SnapshotValue& in, const std::vector<Obj*>& objects, Value* out)
+{
+	switch (in.type)
+	{
+	case VAL_BOOL: *out = createBool(in.object != 0); return true;
+	case VAL_NIL: *out = createNil(); return true;
+	case VAL_NUMBER: *out = createNumber(in.number); return true;
+	case VAL_OBJ:
+		if (in.object >= objects.size()) return false;
+		*out = createObject(objects[in.object]);
+		return true;
+	}
+	return false;
+}
+
+static bool readSnapshot(VM* vm, const uint8_t* image, size_t size)
+{
+	SnapshotHeader header;
+	if (size < sizeof(header)) return false;
+	memcpy(&header, image, sizeof(header));
+	if (memcmp(header.magic, PKI_MAGIC, sizeof(PKI_MAGIC)) != 0) return false;
+	if (header.version != PKI_VERSION || header.byteOrder != PKI_BYTE_ORDER) return false;
+
+	uint64_t expected = sizeof(header) + (uint64_t)header.objectCount * sizeof(SnapshotObject)
+		+ (uint64_t)header.globalCount * sizeof(SnapshotGlobal) + header.dataBytes;
+	if (expected != size) return false;
+
+	const uint8_t* table = image + sizeof(header);
+	const uint8_t* globals = table + header.objectCount * sizeof(SnapshotObject);
+	const char* data = (const char*)(globals + header.globalCount * sizeof(SnapshotGlobal));
+	auto inData = [&](uint64_t offset, uint64_t length) { return offset + length <= header.dataBytes; };
+
+	// first every object, then the references between them
+	std::vector<Obj*> objects(header.objectCount);
+	std::vector<SnapshotObject> entries(header.objectCount);
+	for (uint32_t i = 0; i < header.objectCount; i++)
+	{
+		SnapshotObject& entry = entries[i];
+		memcpy(&entry, table + i * sizeof(SnapshotObject), sizeof(entry));
+		if (!inData(entry.offset, entry.length)) return false;
+		if (entry.type == OBJ_STRING)
+		{
+			objects[i] = (Obj*)copyString(vm, data + entry.offset, (int)entry.length);
+		}
+		else if (entry.type == OBJ_FUNCTION)
+		{
+			ObjFunction* function = newFunction(vm);
+			function->arity = entry.arity;
+			function->line = entry.line;
+			function->compiled = entry.compiled != 0;
+			function->source.assign(data + entry.offset, entry.length);
+			accountHeap(vm, HEAP_FUNCTION, stringHeapBytes(function->source));
+			objects[i] = (Obj*)function;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < header.objectCount; i++)
+	{
+		SnapshotObject& entry = entries[i];
+		if (entry.type != OBJ_FUNCTION) continue;
+		ObjFunction* function = (ObjFunction*)objects[i];
+		if (entry.name >= objects.size() || entries[entry.name].type != OBJ_STRING) return false;
+		function->name = (ObjString*)objects[entry.name];
+
+		uint64_t linesOffset = entry.chunkOffset + entry.codeLength;
+		uint64_t constantsOffset = linesOffset + (uint64_t)entry.lineCount * sizeof(SnapshotLine);
+		if (!inData(entry.chunkOffset, constantsOffset - entry.chunkOffset + (uint64_t)entry.constantCount * sizeof(SnapshotValue)))
+			return false;
+
+		Chunk& chunk = function->chunk;
+		chunk.code.assign(data + entry.chunkOffset, data + entry.chunkOffset + entry.codeLength);
+		chunk.lines.resize(entry.lineCount);
+		for (uint32_t j = 0; j < entry.lineCount; j++)
+		{
+			SnapshotLine line;
+			memcpy(&line, data + linesOffset + j * sizeof(SnapshotLine), sizeof(line));
+			chunk.lines[j] = { line.offset, line.line };
+		}
+		chunk.constants.resize(entry.constantCount);
+		for (uint32_t j = 0; j < entry.constantCount; j++)
+		{
+			SnapshotValue value;
+			memcpy(&value, data + constantsOffset + j * sizeof(SnapshotValue), sizeof(value));
+			if (!restoreValue(value, objects, &chunk.constants[j])) return false;
+		}
+		if (function->compiled) accountHeap(vm, HEAP_CHUNK, chunkHeapBytes(&chunk));
+	}
+
+	for (uint32_t i = 0; i < header.globalCount; i++)
+	{
+		SnapshotGlobal global;
+		memcpy(&global, globals + i * sizeof(SnapshotGlobal), sizeof(global));
+		Value value;
+		if (!inData(global.nameOffset, global.nameLength) || !restoreValue(global.value, objects, &value)) return false;
+		bindGlobal(vm, vm->globals, std::string(data + global.nameOffset, global.nameLength), value);
+	}
+	return true;
+}
+
+bool loadSnapshot(VM* vm, const std::string& path)
+{
+	bool loaded = false;
+#ifndef _WIN32
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		size_t size = (size_t)info.st_size;
+		void* image = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (image != MAP_FAILED)
+		{
+			madvise(image, size, MADV_SEQUENTIAL);
+			loaded = readSnapshot(vm, (const uint8_t*)image, size);
+			munmap(image, size);
+		}
+	}
+	close(fd);
+#else
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!in) return false;
+	std::vector<uint8_t> image((size_t)in.tellg());
+	in.seekg(0, std::ios::beg);
+	in.read((char*)image.data(), image.size());
+	loaded = in && readSnapshot(vm, image.data(), image.size());
+#endif
+	return loaded;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "VM.h"
+
+#include <string>
+
+// Heap images (.pki). A snapshot holds a VM's globals and the strings and functions they
+// reach, compiled chunks included, so a VM can start where a setup script left off
+// without running it again. Objects refer to each other by index; restoring maps the
+// file and rebuilds the objects, fixing the indexes up into pointers.
+// Modules are not kept: a restored VM imports them afresh.
+#define PKI_VERSION 1
+
+// Fails, with the reason in `error`, if a global holds a coroutine, task or channel.
+bool writeSnapshot(VM* vm, const std::string& path, std::string* error);
+
+// Into a VM that has not run anything yet.
+bool loadSnapshot(VM* vm, const std::string& path);
@@ -0,0 +1,91 @@
+#include "pkscript.h"
+#include "Source.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool openSource(Source* source, const std::string& path)
+{
+	source->mapped = false;
+	source->buffer.clear();
+#ifndef _WIN32
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	size_t size = (size_t)info.st_size;
+	if (size > 0)
+	{
+		void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) return false;
+		madvise(data, size, MADV_SEQUENTIAL);
+
+		source->start = (const char*)data;
+		source->end = source->start + size;
+		source->released = source->start;
+		source->mapped = true;
+		return true;
+	}
+	close(fd);
+#else
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!in) return false;
+	source->buffer.resize((size_t)in.tellg());
+	in.seekg(0, std::ios::beg);
+	in.read(&source->buffer[0], source->buffer.size());
+#endif
+	source->start = source->buffer.data();
+	source->end = source->start + source->buffer.size();
+	source->released = source->start;
+	return true;
+}
+
+void sourceFromString(Source* source, const char* chars, size_t length)
+{
+	source->start = chars;
+	source->end = chars + length;
+	source->released = chars;
+	source->mapped = false;
+}
+
+void closeSource(Source* source)
+{
+#ifndef _WIN32
+	if (source->mapped)
+	{
+		munmap((void*)source->start, source->end - source->start);
+	}
+#endif
+	source->mapped = false;
+	source->buffer.clear();
+	source->start = source->end = source->released = nullptr;
+}
+
+void slideWindow(Source* source, const char* position)
+{
+#ifndef _WIN32
+	if (!source->mapped || position - source->released < 2 * SOURCE_WINDOW) return;
+
+	static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t offset = (size_t)(position - SOURCE_WINDOW - source->start);
+	offset -= offset % pageSize;
+
+	const char* release = source->start + offset;
+	if (release <= source->released) return;
+
+	// the mapping is read-only and file backed, so dropped pages are re-read on access
+	madvise((void*)source->released, release - source->released, MADV_DONTNEED);
+	source->released = release;
+#endif
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+// Bytes of an mmapped source kept resident behind the scanner. Pages before the
+// window are handed back to the kernel, so compiling a multi-GB script does not
+// grow RSS with the file size. Tokens that still point there simply fault back in.
+#define SOURCE_WINDOW (32 * 1024 * 1024)
+
+struct Source
+{
+	const char* start;
+	const char* end;
+	const char* released;
+	bool mapped;
+	std::string buffer;
+};
+
+bool openSource(Source* source, const std::string& path);
+
+void sourceFromString(Source* source, const char* chars, size_t length);
+
+void closeSource(Source* source);
+
+void slideWindow(Source* source, const char* position);
@@ -0,0 +1,165 @@
+#include "Spawn.h"
+#include "Cache.h"
+#include "Memory.h"
+#include "Natives.h"
+#include "Sampler.h"
+
+#include <unordered_map>
+
+using FunctionCopies = std::unordered_map<ObjFunction*, ObjFunction*>;
+
+static bool copyValue(VM* to, Value value, Value* copy, FunctionCopies& functions);
+
+static ObjFunction* copyFunction(VM* to, ObjFunction* function, FunctionCopies& functions)
+{
+	auto found = functions.find(function);
+	if (found != functions.end()) return found->second;
+
+	ObjFunction* copy = newFunction(to);
+	functions.emplace(function, copy);
+	copy->name = copyString(to, function->name->string.c_str(), (int)function->name->string.size());
+	copy->arity = function->arity;
+	copy->line = function->line;
+	copy->compiled = function->compiled;
+	copy->source = function->source;
+	accountHeap(to, HEAP_FUNCTION, stringHeapBytes(copy->source));
+
+	copy->chunk.code = function->chunk.code;
+	copy->chunk.lines = function->chunk.lines;
+	copy->chunk.constants.reserve(function->chunk.constants.size());
+	for (Value constant : function->chunk.constants)
+	{
+		Value copied = createNil();
+		copyValue(to, constant, &copied, functions);
+		copy->chunk.constants.push_back(copied);
+	}
+	if (copy->compiled) accountHeap(to, HEAP_CHUNK, chunkHeapBytes(&copy->chunk));
+	return copy;
+}
+
+static bool copyValue(VM* to, Value value, Value* copy, FunctionCopies& functions)
+{
+	if (!IS_OBJ(value))
+	{
+		*copy = value;
+		return true;
+	}
+	switch (OBJ_TYPE(value))
+	{
+	case OBJ_STRING:
+		*copy = createObject((Obj*)copyString(to, AS_CSTRING(value), (int)AS_STRING(value)->string.size()));
+		return true;
+	case OBJ_FUNCTION:
+		*copy = createObject((Obj*)copyFunction(to, AS_FUNCTION(value), functions));
+		return true;
+	case OBJ_CHANNEL:
+		*copy = createObject((Obj*)newChannelObject(to, AS_CHANNEL(value)->channel));
+		return true;
+	default:
+		return false;
+	}
+}
+
+static VM* newChild(VM* vm)
+{
+	VM* child = new VM(createVM());
+	child->useCache = vm->useCache;
+	child->stripLines = vm->stripLines;
+	child->heapLimit = vm->heapLimit;
+	child->out = vm->out;
+	child->err = vm->err;
+	child->scriptDirectory = vm->scriptDirectory;
+	if (vm->ioNatives) defineIoNatives(child);
+
+	// natives stay the child's own
+	FunctionCopies functions;
+	for (auto& global : vm->globals)
+	{
+		if (IS_NATIVE(global.second)) continue;
+		Value copy;
+		if (copyValue(child, global.second, &copy, functions)) bindGlobal(child, child->globals, global.first, copy);
+	}
+	return child;
+}
+
+static void finishTask(ObjTask* task, VM* child, InterpretResult result)
+{
+	task->failed = result != INTERPRET_OK;
+	if (task->failed || !toMessage(child->stack.back(), &task->result))
+	{
+		task->result = Message();
+		task->result.kind = Message::MESSAGE_NIL;
+	}
+	task->finished.store(true, std::memory_order_release);
+	unsampleThread();
+	freeVM(child);
+	delete child;
+}
+
+ObjTask* spawnFunction(VM* vm, ObjFunction* function, int argCount, Value* args)
+{
+	VM* child = newChild(vm);
+	FunctionCopies functions;
+	Chunk call;
+	Value callee = createObject((Obj*)copyFunction(child, function, functions));
+	writeConstant(&call, callee, function->line);
+	for (int i = 0; i < argCount; i++)
+	{
+		Value copy;
+		if (!copyValue(child, args[i], &copy, functions))
+		{
+			freeVM(child);
+			delete child;
+			runtimeError(vm, "spawn() can only pass numbers, bools, nil, strings, functions and channels.");
+			return nullptr;
+		}
+		writeConstant(&call, copy, function->line);
+	}
+	writeChunk(&call, OP_CALL, function->line);
+	writeChunk(&call, (uint8_t)argCount, function->line);
+	writeChunk(&call, OP_RETURN, function->line);
+	startScript(child, &call);
+
+	ObjTask* task = newTask(vm);
+	task->thread = std::thread([task, child]()
+	{
+		sampleThread(child);
+		finishTask(task, child, resume(child, 0));
+	});
+	return task;
+}
+
+ObjTask* spawnFile(VM* vm, const std::string& path)
+{
+	VM* child = newChild(vm);
+	ObjTask* task = newTask(vm);
+	task->thread = std::thread([task, child, path]()
+	{
+		sampleThread(child);
+		Chunk chunk;
+		FileStatus status = compileFile(child, path, child->useCache, &chunk);
+		if (status == FILE_NOT_FOUND) fprintf(child->err, "Could not open file %s.\n", path.c_str());
+		if (status != FILE_OK)
+		{
+			finishTask(task, child, INTERPRET_COMPILE_ERROR);
+			return;
+		}
+		setScriptPath(child, path);
+		startScript(child, &chunk);
+		finishTask(task, child, resume(child, 0));
+	});
+	return task;
+}
+
+bool joinTask(VM* vm, ObjTask* task, Value* result)
+{
+	if (!task->joined)
+	{
+		task->thread.join();
+		task->joined = true;
+	}
+	if (task->failed) return false;
+	Message copy = task->result;
+	*result = fromMessage(vm, &copy);
+	return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Object.h"
+#include "VM.h"
+
+#include <string>
+
+// Tasks run in a child VM on a thread of their own. The child starts out with copies of
+// the parent's functions and plain globals and after that shares nothing with it but the
+// channels passed along. Output goes to the parent's streams.
+
+// Runs function(args...). Returns nullptr after a runtime error if an argument cannot be
+// copied to another heap.
+ObjTask* spawnFunction(VM* vm, ObjFunction* function, int argCount, Value* args);
+
+// Runs the script at `path`, compiled by the child.
+ObjTask* spawnFile(VM* vm, const std::string& path);
+
+// Waits for the task and copies its return value into `vm`. Returns false if it failed.
+bool joinTask(VM* vm, ObjTask* task, Value* result);
@@ -0,0 +1,100 @@
+#include "ThreadPool.h"
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+unsigned workerCount()
+{
+	unsigned count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+// The items [next, end) a worker has not started yet. The owner takes from the front,
+// thieves take from the back.
+struct WorkRange
+{
+	std::mutex lock;
+	size_t next;
+	size_t end;
+};
+
+static bool takeFront(WorkRange* range, size_t* item)
+{
+	std::lock_guard<std::mutex> guard(range->lock);
+	if (range->next == range->end) return false;
+	*item = range->next++;
+	return true;
+}
+
+static bool steal(std::vector<std::unique_ptr<WorkRange>>& ranges, WorkRange* thief)
+{
+	// pick the victim with the most work left; sizes may be stale, which only costs a retry
+	WorkRange* victim = nullptr;
+	size_t most = 0;
+	for (auto& range : ranges)
+	{
+		std::lock_guard<std::mutex> guard(range->lock);
+		size_t left = range->end - range->next;
+		if (range.get() != thief && left > most)
+		{
+			victim = range.get();
+			most = left;
+		}
+	}
+	if (victim == nullptr) return false;
+
+	size_t begin, end;
+	{
+		std::lock_guard<std::mutex> guard(victim->lock);
+		size_t left = victim->end - victim->next;
+		if (left == 0) return true;
+		end = victim->end;
+		begin = end - (left + 1) / 2;
+		victim->end = begin;
+	}
+	std::lock_guard<std::mutex> guard(thief->lock);
+	thief->next = begin;
+	thief->end = end;
+	return true;
+}
+
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& work)
+{
+	if (threads > count) threads = (unsigned)count;
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i < count; i++) work(i);
+		return;
+	}
+
+	std::vector<std::unique_ptr<WorkRange>> ranges;
+	for (unsigned i = 0; i < threads; i++)
+	{
+		ranges.emplace_back(new WorkRange);
+		ranges.back()->next = count * i / threads;
+		ranges.back()->end = count * (i + 1) / threads;
+	}
+
+	auto worker = [&](unsigned index)
+	{
+		WorkRange* own = ranges[index].get();
+		size_t item;
+		do
+		{
+			while (takeFront(own, &item)) work(item);
+		} while (steal(ranges, own));
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; i++)
+	{
+		pool.emplace_back(worker, i);
+	}
+	worker(0);
+	for (std::thread& thread : pool)
+	{
+		thread.join();
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+
+unsigned workerCount();
+
+// Runs work(0) .. work(count - 1) on up to `threads` worker threads and returns once all
+// of them are done. Each worker starts on its own contiguous slice of the items and, when
+// that runs dry, steals the back half of the busiest remaining slice, so a few large items
+// still balance without every item going through one shared counter.
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& work);
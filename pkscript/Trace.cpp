@@ -0,0 +1,223 @@
+#include "pkscript.h"
+#include "Trace.h"
+#include "Debug.h"
+#include "Object.h"
+
+#include <cstring>
+#include <vector>
+
+static const char TRACE_MAGIC[4] = { 'P', 'K', 'T', 0x1A };
+static const uint32_t TRACE_VERSION = 2;
+
+enum TraceBlock : uint8_t
+{
+	TRACE_CHUNK,
+	TRACE_RECORDS,
+};
+
+// Constants are stored only as far as disassembleInstruction() needs them: anything that
+// is not a plain value is kept as the text printValue() would show for it.
+enum TraceConstant : uint8_t
+{
+	TRACE_BOOL,
+	TRACE_NIL,
+	TRACE_NUMBER,
+	TRACE_TEXT,
+};
+
+template <typename T>
+static void put(FILE* file, const T& value)
+{
+	fwrite(&value, sizeof(T), 1, file);
+}
+
+static void putText(FILE* file, const std::string& text)
+{
+	put(file, (uint32_t)text.size());
+	fwrite(text.data(), 1, text.size(), file);
+}
+
+Trace* openTrace(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr) return nullptr;
+	fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file);
+	put(file, TRACE_VERSION);
+
+	Trace* trace = new Trace();
+	trace->file = file;
+	trace->records = new TraceRecord[TRACE_BUFFER];
+	trace->count = 0;
+	trace->chunk = nullptr;
+	trace->chunkId = 0;
+	return trace;
+}
+
+void closeTrace(Trace* trace)
+{
+	flushTrace(trace);
+	fclose(trace->file);
+	delete[] trace->records;
+	delete trace;
+}
+
+void flushTrace(Trace* trace)
+{
+	if (trace->count == 0) return;
+	put(trace->file, (uint8_t)TRACE_RECORDS);
+	put(trace->file, (uint32_t)trace->count);
+	fwrite(trace->records, sizeof(TraceRecord), trace->count, trace->file);
+	trace->count = 0;
+}
+
+static void writeChunk(Trace* trace, Chunk* chunk, uint32_t id)
+{
+	FILE* file = trace->file;
+	put(file, (uint8_t)TRACE_CHUNK);
+	put(file, id);
+	put(file, (uint32_t)chunk->code.size());
+	fwrite(chunk->code.data(), 1, chunk->code.size(), file);
+	put(file, (uint32_t)chunk->lines.size());
+	for (LineStart& start : chunk->lines)
+	{
+		put(file, start.offset);
+		put(file, (int32_t)start.line);
+	}
+	put(file, (uint32_t)chunk->constants.size());
+	for (Value& value : chunk->constants)
+	{
+		switch (value.type)
+		{
+		case VAL_BOOL: put(file, (uint8_t)TRACE_BOOL); put(file, (uint8_t)AS_BOOL(value)); break;
+		case VAL_NIL: put(file, (uint8_t)TRACE_NIL); break;
+		case VAL_NUMBER: put(file, (uint8_t)TRACE_NUMBER); put(file, AS_NUMBER(value)); break;
+		case VAL_OBJ:
+			put(file, (uint8_t)TRACE_TEXT);
+			if (IS_STRING(value)) putText(file, AS_STRING(value)->string);
+			else putText(file, "<fn " + AS_FUNCTION(value)->name->string + ">");
+			break;
+		}
+	}
+}
+
+void enterTraceChunk(Trace* trace, Chunk* chunk)
+{
+	auto found = trace->chunks.find(chunk);
+	if (found == trace->chunks.end())
+	{
+		// records already buffered must stay behind the chunks they refer to
+		flushTrace(trace);
+		found = trace->chunks.emplace(chunk, (uint32_t)trace->chunks.size()).first;
+		writeChunk(trace, chunk, found->second);
+	}
+	trace->chunk = chunk;
+	trace->chunkId = found->second;
+}
+
+template <typename T>
+static bool get(FILE* file, T* value)
+{
+	return fread(value, sizeof(T), 1, file) == 1;
+}
+
+static bool readChunk(VM* vm, FILE* file, std::vector<Chunk>& chunks)
+{
+	uint32_t id, length;
+	if (!get(file, &id) || !get(file, &length)) return false;
+	if (id >= chunks.size()) chunks.resize(id + 1);
+	Chunk& chunk = chunks[id];
+	chunk = Chunk();
+
+	chunk.code.resize(length);
+	if (fread(chunk.code.data(), 1, length, file) != length) return false;
+
+	uint32_t lineCount;
+	if (!get(file, &lineCount)) return false;
+	for (uint32_t i = 0; i < lineCount; i++)
+	{
+		uint32_t offset;
+		int32_t line;
+		if (!get(file, &offset) || !get(file, &line)) return false;
+		chunk.lines.push_back({ offset, line });
+	}
+
+	uint32_t constantCount;
+	if (!get(file, &constantCount)) return false;
+	for (uint32_t i = 0; i < constantCount; i++)
+	{
+		uint8_t type;
+		if (!get(file, &type)) return false;
+		switch (type)
+		{
+		case TRACE_BOOL:
+		{
+			uint8_t boolean;
+			if (!get(file, &boolean)) return false;
+			chunk.constants.push_back(createBool(boolean != 0));
+			break;
+		}
+		case TRACE_NIL: chunk.constants.push_back(createNil()); break;
+		case TRACE_NUMBER:
+		{
+			double number;
+			if (!get(file, &number)) return false;
+			chunk.constants.push_back(createNumber(number));
+			break;
+		}
+		case TRACE_TEXT:
+		{
+			uint32_t size;
+			if (!get(file, &size)) return false;
+			std::string text(size, '\0');
+			if (fread(&text[0], 1, size, file) != size) return false;
+			chunk.constants.push_back(createObject((Obj*)takeString(vm, text)));
+			break;
+		}
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool readRecords(FILE* file, std::vector<Chunk>& chunks)
+{
+	uint32_t count;
+	if (!get(file, &count)) return false;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		TraceRecord record;
+		if (!get(file, &record)) return false;
+		// the disassembler reads the operands and constants without checking them
+		if (record.chunk >= chunks.size() || checkInstruction(&chunks[record.chunk], record.offset) == 0) return false;
+
+		printf("%3u %5u ", record.frameDepth, record.stackDepth);
+		disassembleInstruction(&chunks[record.chunk], record.offset);
+	}
+	return true;
+}
+
+bool decodeTrace(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr) return false;
+
+	char magic[4];
+	uint32_t version;
+	bool valid = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+		&& memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0
+		&& get(file, &version) && version == TRACE_VERSION;
+
+	VM vm = createVM();
+	std::vector<Chunk> chunks;
+	uint8_t block;
+	while (valid && get(file, &block))
+	{
+		if (block == TRACE_CHUNK) valid = readChunk(&vm, file, chunks);
+		else if (block == TRACE_RECORDS) valid = readRecords(file, chunks);
+		else valid = false;
+	}
+	fclose(file);
+	freeVM(&vm);
+	return valid;
+}
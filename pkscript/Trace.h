@@ -0,0 +1,60 @@
+#pragma once
+
+#include "VM.h"
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+
+// Binary execution trace for --trace. Every instruction run() executes becomes one
+// TraceRecord in a fixed buffer that is appended to the trace file whenever it fills.
+// Each chunk is written to the file the first time execution enters it, so the file
+// is self-contained and --decode-trace can disassemble it without the sources.
+#define TRACE_BUFFER 65536
+
+struct TraceRecord
+{
+	uint32_t offset;
+	uint32_t chunk;
+	uint32_t stackDepth;
+	uint8_t opcode;
+	uint8_t frameDepth;
+	uint16_t reserved;
+};
+
+struct Trace
+{
+	FILE* file;
+	TraceRecord* records;
+	size_t count;
+	Chunk* chunk;
+	uint32_t chunkId;
+	std::unordered_map<Chunk*, uint32_t> chunks;
+};
+
+Trace* openTrace(const std::string& path);
+
+// Flushes what is left in the buffer and closes the file.
+void closeTrace(Trace* trace);
+
+void enterTraceChunk(Trace* trace, Chunk* chunk);
+
+void flushTrace(Trace* trace);
+
+static inline void traceInstruction(Trace* trace, VM* vm)
+{
+	if (vm->chunk != trace->chunk) enterTraceChunk(trace, vm->chunk);
+
+	TraceRecord& record = trace->records[trace->count];
+	record.offset = (uint32_t)(vm->ip - vm->chunk->code.data());
+	record.chunk = trace->chunkId;
+	record.stackDepth = (uint32_t)vm->stack.size();
+	record.opcode = *vm->ip;
+	record.frameDepth = (uint8_t)vm->frames.size();
+	record.reserved = 0;
+	if (++trace->count == TRACE_BUFFER) flushTrace(trace);
+}
+
+// Prints every record of a trace file as "frames stack" followed by the disassembled
+// instruction. Returns false when the file is missing or malformed.
+bool decodeTrace(const std::string& path);
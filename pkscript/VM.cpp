@@ -1,62 +1,284 @@
 #include "pkscript.h"
 #include "VM.h"
+#include "Cache.h"
 #include "Compiler.h"
 #include "Memory.h"
 #include "Debug.h"
+#include "HeapProfile.h"
+#include "Natives.h"
 #include "Object.h"
+#include "Profiler.h"
+#include "Program.h"
+#include "Trace.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <stdarg.h>
 
-VM* activeVM;
-
-VM* currentVM()
+uint64_t clockNanos()
 {
-	return activeVM;
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 VM createVM()
 {
 	VM vm;
+	vm.chunk = nullptr;
+	vm.ip = nullptr;
+	vm.function = nullptr;
+	vm.slots = 0;
+	vm.frames.reserve(FRAMES_MAX);
 	vm.stack.clear();
 	vm.globals.clear();
 	vm.objects = nullptr;
+	vm.useCache = true;
+	vm.stripLines = false;
+	vm.collectStats = false;
+	memset(&vm.stats, 0, sizeof(vm.stats));
+	vm.stackBytes = 0;
+	accountStack(&vm, vm.stack, vm.frames, &vm.stackBytes);
+	vm.heapLimit = 0;
+	vm.trace = nullptr;
+	vm.heapProfile = nullptr;
+	vm.programs.clear();
+	vm.out = stdout;
+	vm.err = stderr;
+	vm.entry = nullptr;
+	vm.budgetEnd = 0;
+	vm.coroutine = nullptr;
+	vm.loop = nullptr;
+	vm.ioNatives = false;
+	vm.waitFd = -1;
+	vm.waitWrite = false;
+	vm.retry = false;
+	vm.baseDepth = 0;
+	vm.baseCoroutine = nullptr;
+#ifdef PROFILE_OPS
+	vm.profile = nullptr;
+#endif
+	defineNatives(&vm);
 	return vm;
 }
 
 void freeVM(VM* vm)
 {
-	freeObjects();
+	closeFiles(vm);
+	freeObjects(vm);
+	// after the intern table is gone, since it may point into the programs' heaps
+	forgetPrograms(vm);
+	if (vm->heapProfile != nullptr)
+	{
+		freeHeapProfile(vm->heapProfile);
+		vm->heapProfile = nullptr;
+	}
+}
+
+VMStats vmStats(VM* vm)
+{
+	VMStats stats = vm->stats;
+	stats.internedStrings = vm->strings.size();
+	return stats;
 }
 
-static void runtimeError(VM* vm, const char* format...)
+static void relinkConstants(Chunk* chunk, std::unordered_map<Obj*, Obj*>& duplicates)
+{
+	for (Value& value : chunk->constants)
+	{
+		if (!IS_OBJ(value)) continue;
+
+		auto duplicate = duplicates.find(AS_OBJ(value));
+		if (duplicate != duplicates.end()) value.as.obj = duplicate->second;
+
+		if (IS_FUNCTION(value))
+		{
+			ObjFunction* function = AS_FUNCTION(value);
+			auto name = duplicates.find((Obj*)function->name);
+			if (name != duplicates.end()) function->name = (ObjString*)name->second;
+			relinkConstants(&function->chunk, duplicates);
+		}
+	}
+}
+
+// Moves every object owned by `from` (typically a VM used only to compile `chunk` on
+// another thread) into `vm`. String constants that `vm` has already interned are
+// re-pointed at its copy so string identity holds after the merge.
+void adoptHeap(VM* vm, VM* from, Chunk* chunk)
+{
+	std::unordered_map<Obj*, Obj*> duplicates;
+	for (auto& entry : from->strings)
+	{
+		auto existing = vm->strings.find(entry.first);
+		if (existing != vm->strings.end())
+			duplicates.emplace((Obj*)entry.second, (Obj*)existing->second);
+		else
+			vm->strings.emplace(entry.first, entry.second);
+	}
+	if (!duplicates.empty()) relinkConstants(chunk, duplicates);
+
+	if (from->objects != nullptr)
+	{
+		Obj* tail = from->objects;
+		while (tail->next != nullptr) tail = tail->next;
+		tail->next = vm->objects;
+		vm->objects = from->objects;
+	}
+	from->objects = nullptr;
+	from->strings.clear();
+
+	vm->stats.scanTime += from->stats.scanTime;
+	vm->stats.compileTime += from->stats.compileTime;
+	vm->stats.bytecodeBytes += from->stats.bytecodeBytes;
+	vm->stats.constants += from->stats.constants;
+	vm->stats.objectsAllocated += from->stats.objectsAllocated;
+	vm->stats.stringsAllocated += from->stats.stringsAllocated;
+	// only the objects move; `from` keeps its own stack
+	accountHeap(from, HEAP_STACK, -(int64_t)from->stackBytes);
+	vm->stats.bytesAllocated += from->stats.bytesAllocated;
+	for (int category = 0; category < HEAP_CATEGORY_COUNT; category++)
+	{
+		vm->stats.heapBytes[category] += from->stats.heapBytes[category];
+	}
+	vm->stats.peakBytes = std::max(vm->stats.peakBytes, vm->stats.bytesAllocated);
+	memset(&from->stats, 0, sizeof(from->stats));
+	accountHeap(from, HEAP_STACK, from->stackBytes);
+}
+
+static void printFrames(VM* vm, CallFrame frame, std::vector<CallFrame>& frames)
+{
+	for (size_t i = frames.size() + 1; i-- > 0;)
+	{
+		// the frame saved by a host's invoke() on an idle VM has no code of its own
+		if (frame.chunk == nullptr)
+		{
+			if (i > 0) frame = frames[i - 1];
+			continue;
+		}
+		size_t instruction = frame.ip - frame.chunk->code.data() - 1;
+		int line = getLine(frame.chunk, instruction);
+
+		if (line < 0)
+			fprintf(vm->err, "[byte %zu] in ", instruction);
+		else
+			fprintf(vm->err, "[line %d] in ", line);
+		if (frame.function == nullptr)
+			fprintf(vm->err, "script\n");
+		else
+			fprintf(vm->err, "%s()\n", frame.function->name->string.c_str());
+
+		if (i > 0) frame = frames[i - 1];
+	}
+}
+
+void runtimeError(VM* vm, const char* format...)
 {
 	va_list args;
 	va_start(args, format);
-	vfprintf(stderr, format, args);
+	vfprintf(vm->err, format, args);
 	va_end(args);
-	fputs("\n", stderr);
+	fputs("\n", vm->err);
 
-	size_t instruction = vm->ip - vm->chunk->code.data() - 1;
-	int line = getLine(vm->chunk, instruction);
+	printFrames(vm, { vm->function, vm->chunk, vm->ip, vm->slots }, vm->frames);
+	// each running coroutine holds the frames of whoever resumed it
+	for (ObjCoroutine* coroutine = vm->coroutine; coroutine != nullptr; coroutine = coroutine->resumer)
+	{
+		printFrames(vm, { coroutine->function, coroutine->chunk, coroutine->ip, coroutine->slots }, coroutine->frames);
+		coroutine->state = COROUTINE_DONE;
+	}
+	vm->coroutine = nullptr;
+	vm->stack.clear();
+	vm->frames.clear();
+	vm->slots = 0;
+	// a host that calls in again must not save the failed frame as its own
+	vm->function = nullptr;
+	vm->chunk = nullptr;
+}
 
-	fprintf(stderr, "[line &d] in script\n", line);
+static bool heapExceeded(VM* vm)
+{
+	if (vm->heapLimit == 0 || vm->stats.bytesAllocated <= vm->heapLimit) return false;
+	runtimeError(vm, "Out of memory: %llu bytes in use, limit is %llu.",
+		(unsigned long long)vm->stats.bytesAllocated, (unsigned long long)vm->heapLimit);
+	return true;
+}
+
+void accountStack(VM* vm, ValueArray& stack, std::vector<CallFrame>& frames, size_t* accounted)
+{
+	size_t bytes = stack.capacity() * sizeof(Value) + frames.capacity() * sizeof(CallFrame);
+	accountHeap(vm, HEAP_STACK, (int64_t)bytes - (int64_t)*accounted);
+	*accounted = bytes;
+}
+
+void bindGlobal(VM* vm, std::unordered_map<std::string, Value>& table, const std::string& name, Value value)
+{
+	auto bound = table.insert_or_assign(name, value);
+	if (bound.second) accountHeap(vm, HEAP_GLOBAL, GLOBAL_ENTRY_BYTES + stringHeapBytes(bound.first->first));
+}
+
+void start(VM* vm, Chunk* chunk)
+{
+	vm->entry = chunk;
+	vm->chunk = chunk;
+	vm->ip = &vm->chunk->code[0];
+	vm->function = nullptr;
+	vm->slots = 0;
+	vm->frames.clear();
 	vm->stack.clear();
+	vm->coroutine = nullptr;
+	if (vm->trace != nullptr)
+	{
+		// a REPL line's chunk can reuse the address of the previous one
+		vm->trace->chunks.erase(chunk);
+		vm->trace->chunk = nullptr;
+	}
+
+	// the caller owns the chunk, so it only counts against the heap while it runs
+	accountHeap(vm, HEAP_CHUNK, (int64_t)chunkHeapBytes(chunk));
+}
+
+void startScript(VM* vm, Chunk* chunk)
+{
+	vm->script = std::move(*chunk);
+	*chunk = Chunk();
+	start(vm, &vm->script);
+}
+
+InterpretResult resume(VM* vm, uint64_t budget)
+{
+	vm->budgetEnd = budget == 0 ? 0 : vm->stats.instructions + budget;
+	vm->waitFd = -1;
+	vm->retry = false;
+	uint64_t compileTime = vm->stats.compileTime;
+	uint64_t started = clockNanos();
+	InterpretResult result = heapExceeded(vm) ? INTERPRET_RUNTIME_ERROR : run(vm);
+	vm->stats.executeTime += clockNanos() - started - (vm->stats.compileTime - compileTime);
+	if (result == INTERPRET_YIELDED) return result;
+
+	accountHeap(vm, HEAP_CHUNK, -(int64_t)chunkHeapBytes(vm->entry));
+	if (vm->entry == &vm->script) vm->script = Chunk();
+	vm->entry = nullptr;
+	// tells the sampler there is no running chunk to look at
+	vm->chunk = nullptr;
+	return result;
+}
+
+InterpretResult interpret(VM* vm, Chunk* chunk)
+{
+	start(vm, chunk);
+	return resume(vm, 0);
 }
 
 InterpretResult interpret(VM* vm, const char* source)
 {
-	activeVM = vm;
 	Chunk chunk;
 	if (!compile(vm, source, &chunk))
 	{
 		return INTERPRET_COMPILE_ERROR;
 	}
 
-	vm->chunk = &chunk;
-	vm->ip = &vm->chunk->code[0];
-
-	InterpretResult result = run(vm);
-	return INTERPRET_OK;
+	return interpret(vm, &chunk);
 }
 
 static Value popStack(VM* vm)
@@ -82,14 +304,227 @@ static void concatenate(VM* vm)
 	chr_string += a->string;
 	chr_string += b->string;
 
-	ObjString* result = takeString(chr_string);
+	ObjString* result = takeString(vm, chr_string);
 	vm->stack.push_back(createObject((Obj*)result));
 }
 
-static InterpretResult run(VM* vm)
+static bool call(VM* vm, ObjFunction* function, int argCount)
+{
+	if (!function->compiled && !compileFunction(vm, function))
+	{
+		runtimeError(vm, "Could not compile function '%s'.", function->name->string.c_str());
+		return false;
+	}
+	accountStack(vm, vm->stack, vm->frames, &vm->stackBytes);
+	if (heapExceeded(vm)) return false;
+
+	if (argCount != function->arity)
+	{
+		runtimeError(vm, "Expected %d arguments but got %d.", function->arity, argCount);
+		return false;
+	}
+
+	if (vm->frames.size() == FRAMES_MAX)
+	{
+		runtimeError(vm, "Stack overflow.");
+		return false;
+	}
+
+	vm->frames.push_back({ vm->function, vm->chunk, vm->ip, vm->slots });
+	vm->function = function;
+	vm->chunk = &function->chunk;
+	vm->ip = function->chunk.code.data();
+	vm->slots = vm->stack.size() - argCount - 1;
+	return true;
+}
+
+static bool callNative(VM* vm, ObjNative* native, int argCount)
+{
+	if (native->arity >= 0 && argCount != native->arity)
+	{
+		runtimeError(vm, "Expected %d arguments but got %d.", native->arity, argCount);
+		return false;
+	}
+
+	Value result = createNil();
+	if (!native->function(vm, argCount, &vm->stack[vm->stack.size() - argCount], &result)) return false;
+	if (vm->waitFd >= 0 || vm->retry)
+	{
+		// parked: leave the arguments in place and make the call again on resume
+		vm->ip -= 2;
+		return true;
+	}
+	vm->stack.resize(vm->stack.size() - argCount - 1);
+	vm->stack.push_back(result);
+	accountStack(vm, vm->stack, vm->frames, &vm->stackBytes);
+	return !heapExceeded(vm);
+}
+
+bool callValue(VM* vm, Value callee, int argCount)
+{
+	if (IS_FUNCTION(callee))
+	{
+		return call(vm, AS_FUNCTION(callee), argCount);
+	}
+	if (IS_NATIVE(callee))
+	{
+		return callNative(vm, AS_NATIVE(callee), argCount);
+	}
+	runtimeError(vm, "Can only call functions.");
+	return false;
+}
+
+// Exchanges the VM's registers, frames and stack with the ones parked in `coroutine`.
+static void swapCoroutine(VM* vm, ObjCoroutine* coroutine)
+{
+	std::swap(vm->function, coroutine->function);
+	std::swap(vm->chunk, coroutine->chunk);
+	std::swap(vm->ip, coroutine->ip);
+	std::swap(vm->slots, coroutine->slots);
+	vm->frames.swap(coroutine->frames);
+	vm->stack.swap(coroutine->stack);
+	std::swap(vm->stackBytes, coroutine->stackBytes);
+}
+
+static bool resumeCoroutine(VM* vm, Value value)
+{
+	if (!IS_COROUTINE(value))
+	{
+		runtimeError(vm, "Can only resume coroutines.");
+		return false;
+	}
+	ObjCoroutine* coroutine = AS_COROUTINE(value);
+	if (coroutine->state == COROUTINE_DONE)
+	{
+		runtimeError(vm, "Cannot resume a finished coroutine.");
+		return false;
+	}
+	if (coroutine->state == COROUTINE_RUNNING)
+	{
+		runtimeError(vm, "Coroutine is already running.");
+		return false;
+	}
+	// the stack being parked may have grown since the last call
+	accountStack(vm, vm->stack, vm->frames, &vm->stackBytes);
+	if (heapExceeded(vm)) return false;
+
+	swapCoroutine(vm, coroutine);
+	coroutine->state = COROUTINE_RUNNING;
+	coroutine->resumer = vm->coroutine;
+	vm->coroutine = coroutine;
+	return true;
+}
+
+// Switches back to whoever resumed the running coroutine and hands them `value`.
+static void leaveCoroutine(VM* vm, CoroutineState state, Value value)
+{
+	ObjCoroutine* coroutine = vm->coroutine;
+	if (state == COROUTINE_DONE)
+	{
+		ValueArray().swap(vm->stack);
+		std::vector<CallFrame>().swap(vm->frames);
+	}
+	accountStack(vm, vm->stack, vm->frames, &vm->stackBytes);
+	swapCoroutine(vm, coroutine);
+	coroutine->state = state;
+	vm->coroutine = coroutine->resumer;
+	coroutine->resumer = nullptr;
+	vm->stack.push_back(value);
+}
+
+static bool defineGlobal(VM* vm, ObjString* name)
+{
+	Value value = popStack(vm);
+	bindGlobal(vm, vm->globals, name->string, value);
+	if (vm->function != nullptr && vm->function->module != nullptr)
+	{
+		bindGlobal(vm, vm->function->module->exports, name->string, value);
+	}
+	return !heapExceeded(vm);
+}
+
+void setScriptPath(VM* vm, const std::string& path)
+{
+	std::error_code error;
+	std::filesystem::path absolute = std::filesystem::absolute(path, error);
+	vm->scriptDirectory = error ? std::string() : absolute.parent_path().string();
+}
+
+// The directory of the innermost module whose top level is running, else the script's.
+static std::filesystem::path importBase(VM* vm)
+{
+	if (vm->function != nullptr && vm->function->module != nullptr)
+		return std::filesystem::path(vm->function->name->string).parent_path();
+	for (size_t i = vm->frames.size(); i-- > 0;)
+	{
+		ObjFunction* function = vm->frames[i].function;
+		if (function != nullptr && function->module != nullptr)
+			return std::filesystem::path(function->name->string).parent_path();
+	}
+	return vm->scriptDirectory;
+}
+
+static InterpretResult import(VM* vm, ObjString* name)
+{
+	std::error_code error;
+	std::filesystem::path target(name->string);
+	if (target.is_relative()) target = importBase(vm) / target;
+	std::string path = std::filesystem::canonical(target, error).string();
+	if (error)
+	{
+		runtimeError(vm, "Could not open module '%s'.", name->string.c_str());
+		return INTERPRET_RUNTIME_ERROR;
+	}
+
+	auto found = vm->modules.find(path);
+	if (found != vm->modules.end())
+	{
+		// a module importing one that is still running sees whatever is defined so far
+		for (auto& exported : found->second.exports)
+		{
+			bindGlobal(vm, vm->globals, exported.first, exported.second);
+		}
+		vm->stack.push_back(createNil());
+		return INTERPRET_OK;
+	}
+
+	ObjFunction* function = newFunction(vm);
+	function->name = copyString(vm, path.c_str(), (int)path.size());
+	FileStatus status = compileFile(vm, path, vm->useCache, &function->chunk);
+	if (status != FILE_OK)
+	{
+		runtimeError(vm, "Could not compile module '%s'.", name->string.c_str());
+		return status == FILE_COMPILE_ERROR ? INTERPRET_COMPILE_ERROR : INTERPRET_RUNTIME_ERROR;
+	}
+	function->compiled = true;
+	accountHeap(vm, HEAP_CHUNK, chunkHeapBytes(&function->chunk));
+	if (heapExceeded(vm)) return INTERPRET_RUNTIME_ERROR;
+
+	if (vm->frames.size() == FRAMES_MAX)
+	{
+		runtimeError(vm, "Stack overflow.");
+		return INTERPRET_RUNTIME_ERROR;
+	}
+
+	Module& module = vm->modules[path];
+	module.function = function;
+	module.loaded = false;
+	function->module = &module;
+
+	vm->frames.push_back({ vm->function, vm->chunk, vm->ip, vm->slots });
+	vm->function = function;
+	vm->chunk = &function->chunk;
+	vm->ip = function->chunk.code.data();
+	vm->slots = vm->stack.size();
+	return INTERPRET_OK;
+}
+
+InterpretResult run(VM* vm)
 {
 #define READ_CONSTANT(bytes) ( vm->chunk->constants[readbytes(vm, bytes)])
-#define READ_VARIABLE(bytes) ( vm->stack[readbytes(vm, bytes)])
+#define READ_VARIABLE(bytes) ( vm->stack[vm->slots + readbytes(vm, bytes)])
+// every instruction has completed when this is checked, so run() can simply be re-entered
+#define OUT_OF_BUDGET() (vm->budgetEnd != 0 && vm->stats.instructions >= vm->budgetEnd)
 #define BINARY_OP(valueType, op) \
 do { \
 	if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) \
@@ -116,7 +551,12 @@ do { \
 		printf("\n");
 		disassembleInstruction(vm->chunk, (size_t) (vm->ip - &(vm->chunk->code[0])));
 #endif
+		if (vm->trace != nullptr) traceInstruction(vm->trace, vm);
 		uint8_t instruction = readbytes(vm, 1);
+		vm->stats.instructions++;
+#ifdef PROFILE_OPS
+		if (vm->profile != nullptr) profileInstruction(vm->profile, instruction);
+#endif
 		switch (instruction)
 		{
 			case OP_CONSTANT_SHORT:
@@ -139,23 +579,17 @@ do { \
 			}
 			case OP_DEF_GLOBAL_SHORT:
 			{
-				ObjString* name = AS_STRING(READ_CONSTANT(1));
-				vm->globals.insert_or_assign(name->string, peek(vm, 0));
-				popStack(vm);
+				if (!defineGlobal(vm, AS_STRING(READ_CONSTANT(1)))) return INTERPRET_RUNTIME_ERROR;
 				break;
 			}
 			case OP_DEF_GLOBAL:
 			{
-				ObjString* name = AS_STRING(READ_CONSTANT(2));
-				vm->globals.insert_or_assign(name->string, peek(vm, 0));
-				popStack(vm);
+				if (!defineGlobal(vm, AS_STRING(READ_CONSTANT(2)))) return INTERPRET_RUNTIME_ERROR;
 				break;
 			}
 			case OP_DEF_GLOBAL_LONG:
 			{
-				ObjString* name = AS_STRING(READ_CONSTANT(4));
-				vm->globals.insert_or_assign(name->string, peek(vm, 0));
-				popStack(vm);
+				if (!defineGlobal(vm, AS_STRING(READ_CONSTANT(4)))) return INTERPRET_RUNTIME_ERROR;
 				break;
 			}
 			case OP_GET_GLOBAL_SHORT:
@@ -251,19 +685,19 @@ do { \
 			case OP_SET_LOCAL_SHORT:
 			{
 				uint32_t constant = readbytes(vm, 1);
-				vm->stack[constant] = peek(vm, 0);
+				vm->stack[vm->slots + constant] = peek(vm, 0);
 				break;
 			}
 			case OP_SET_LOCAL:
 			{
 				uint32_t constant = readbytes(vm, 2);
-				vm->stack[constant] = peek(vm, 0);
+				vm->stack[vm->slots + constant] = peek(vm, 0);
 				break;
 			}
 			case OP_SET_LOCAL_LONG:
 			{
 				uint32_t constant = readbytes(vm, 4);
-				vm->stack[constant] = peek(vm, 0);
+				vm->stack[vm->slots + constant] = peek(vm, 0);
 				break;
 			}
 			case OP_FALSE: vm->stack.push_back(createBool(false)); break;
@@ -272,10 +706,12 @@ do { \
 			case OP_NOT: vm->stack.back() = createBool(isFalsey(vm->stack.back())); break;
 			case OP_POP: popStack(vm); break;
 			case OP_EQUAL:
+			{
 				Value b = popStack(vm);
 				Value a = popStack(vm);
 				vm->stack.push_back(createBool(valuesEqual(a, b)));
 				break;
+			}
 			case OP_GREATER: BINARY_OP(createBool, > ); break;
 			case OP_LESS: BINARY_OP(createBool, < ); break;
 			case OP_NEGATE:
@@ -294,6 +730,7 @@ do { \
 				if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1)))
 				{
 					concatenate(vm);
+					if (heapExceeded(vm)) return INTERPRET_RUNTIME_ERROR;
 				}
 				else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 0)))
 				{
@@ -311,7 +748,7 @@ do { \
 			}
 			case OP_MULTIPLY: BINARY_OP(createNumber, *); break;
 			case OP_DIVIDE: BINARY_OP(createNumber, /); break;
-			case OP_PRINT: printValue(popStack(vm)); printf("\n"); break;
+			case OP_PRINT: printValue(vm->out, popStack(vm)); fputc('\n', vm->out); break;
 			case OP_JUMP:
 			{
 				uint16_t offset = readbytes(vm, 2);
@@ -322,6 +759,8 @@ do { \
 			{
 				uint16_t offset = readbytes(vm, 2);
 				vm->ip -= offset;
+				pollHeapDump(vm);
+				if (OUT_OF_BUDGET()) return INTERPRET_YIELDED;
 				break;
 			}
 			case OP_JUMP_IF_TRUE:
@@ -337,15 +776,81 @@ do { \
 				break;
 
 			}
+			case OP_CALL:
+			{
+				int argCount = readbytes(vm, 1);
+				if (!callValue(vm, peek(vm, argCount), argCount))
+				{
+					return INTERPRET_RUNTIME_ERROR;
+				}
+				pollHeapDump(vm);
+				if (OUT_OF_BUDGET() || vm->waitFd >= 0 || vm->retry) return INTERPRET_YIELDED;
+				break;
+			}
+			case OP_IMPORT:
+			{
+				ObjString* name = AS_STRING(popStack(vm));
+				InterpretResult result = import(vm, name);
+				if (result != INTERPRET_OK) return result;
+				break;
+			}
 			case OP_RETURN:
 			{
-				// Exit interpreter
-				return INTERPRET_OK;
+				Value result = popStack(vm);
+				if (vm->function != nullptr && vm->function->module != nullptr)
+				{
+					Module* module = vm->function->module;
+					for (auto& exported : module->exports)
+					{
+						exported.second = vm->globals[exported.first];
+					}
+					module->loaded = true;
+				}
+				if (vm->frames.empty())
+				{
+					if (vm->coroutine != nullptr)
+					{
+						leaveCoroutine(vm, COROUTINE_DONE, result);
+						break;
+					}
+					// Exit interpreter, leaving the result for whoever started the chunk
+					vm->stack.push_back(result);
+					return INTERPRET_OK;
+				}
+
+				vm->stack.resize(vm->slots);
+				vm->stack.push_back(result);
+
+				CallFrame& frame = vm->frames.back();
+				vm->function = frame.function;
+				vm->chunk = frame.chunk;
+				vm->ip = frame.ip;
+				vm->slots = frame.slots;
+				vm->frames.pop_back();
+				if (vm->frames.size() < vm->baseDepth && vm->coroutine == vm->baseCoroutine) return INTERPRET_OK;
+				break;
+			}
+			case OP_YIELD:
+			{
+				Value value = popStack(vm);
+				if (vm->coroutine == nullptr)
+				{
+					runtimeError(vm, "Can't yield outside a coroutine.");
+					return INTERPRET_RUNTIME_ERROR;
+				}
+				leaveCoroutine(vm, COROUTINE_SUSPENDED, value);
+				break;
+			}
+			case OP_RESUME:
+			{
+				if (!resumeCoroutine(vm, popStack(vm))) return INTERPRET_RUNTIME_ERROR;
+				break;
 			}
 		}
 	}
 
-#undef READ_VARIABLE;
+#undef OUT_OF_BUDGET
+#undef READ_VARIABLE
 #undef READ_CONSTANT
 #undef BINARY_OP
 }
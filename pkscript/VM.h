@@ -1,35 +1,178 @@
 #pragma once
 
 #include "Chunk.h"
+#include "Memory.h"
+#include <cstdio>
 #include <unordered_map>
 #include <unordered_set>
 
+#define FRAMES_MAX 64
+
+struct ObjFunction;
+struct OpProfile;
+struct Trace;
+struct HeapProfile;
+struct Program;
+struct ObjCoroutine;
+struct EventLoop;
+
+// A suspended caller. The running frame lives directly in VM::chunk/ip/slots.
+struct CallFrame
+{
+	ObjFunction* function;
+	Chunk* chunk;
+	uint8_t* ip;
+	size_t slots;
+};
+
+// A script loaded with 'import', compiled once per VM. Re-importing it only rebinds
+// the globals its top level defined, as they were when it finished running.
+struct Module
+{
+	ObjFunction* function;
+	std::unordered_map<std::string, Value> exports;
+	bool loaded;
+};
+
+// Counters for --stats. Times are in nanoseconds; compile time covers lazily compiled
+// function bodies too and is not counted again in executeTime.
+struct VMStats
+{
+	uint64_t scanTime;
+	uint64_t compileTime;
+	uint64_t executeTime;
+	uint64_t bytecodeBytes;
+	uint64_t constants;
+	uint64_t instructions;
+	uint64_t objectsAllocated;
+	uint64_t stringsAllocated;
+	uint64_t internedStrings;
+	// everything accounted in heapBytes, which is what the heap limit applies to
+	uint64_t bytesAllocated;
+	uint64_t peakBytes;
+	uint64_t heapBytes[HEAP_CATEGORY_COUNT];
+};
+
 struct VM
 {
 	Chunk* chunk;
 	uint8_t* ip;
+	ObjFunction* function;
+	size_t slots;
+	std::vector<CallFrame> frames;
 	ValueArray stack;
+	// what frames and stack are charged to HEAP_STACK for; swapped along with them
+	size_t stackBytes;
 	Obj* objects;
 	std::unordered_map<std::string, Value> globals;
 	std::unordered_map<std::string, ObjString*> strings;
+	std::unordered_map<std::string, Module> modules;
+	bool useCache;
+	// drop line tables after compiling; runtime errors then report byte offsets
+	bool stripLines;
+	// also times a scan-only pass over every compiled source
+	bool collectStats;
+	VMStats stats;
+	// 0 for no limit; past it, run() stops with an out of memory runtime error
+	uint64_t heapLimit;
+	// set by --trace; null means run() records nothing
+	Trace* trace;
+	// set by --heap-profile; null means allocations are not sampled
+	HeapProfile* heapProfile;
+	// the shared programs whose strings are seeded into this VM's intern table; each holds
+	// a reference, which freeVM() drops
+	std::vector<Program*> programs;
+	// where print, compile errors and runtime errors go
+	FILE* out;
+	FILE* err;
+	// the top-level chunk between start() and the end of the script, null when idle
+	Chunk* entry;
+	// holds the chunk handed to startScript(), so it outlives the caller's frame
+	Chunk script;
+	// run() yields once stats.instructions reaches this; 0 for no budget
+	uint64_t budgetEnd;
+	// the coroutine whose frames and stack are swapped in, null on the main stack
+	ObjCoroutine* coroutine;
+	// set while an event loop runs this VM; I/O natives then park it instead of blocking
+	EventLoop* loop;
+	// set by defineIoNatives(); `files` are the descriptors those natives opened and the
+	// script has not closed yet, the only ones they accept
+	bool ioNatives;
+	std::unordered_set<int> files;
+	// what relative imports resolve against outside any module: the main script's
+	// directory, or empty for the working directory (the REPL, scripts given as text)
+	std::string scriptDirectory;
+	// the descriptor a parked VM waits on, -1 otherwise
+	int waitFd;
+	bool waitWrite;
+	// set by a native that is waiting on another thread (a channel, a task) rather than
+	// a descriptor; like waitFd, the call is made again on the next resume
+	bool retry;
+	// run() returns once a return leaves fewer frames than this on baseCoroutine's stack,
+	// so a host call stops at its own frame instead of running what was below it; 0 for none
+	size_t baseDepth;
+	ObjCoroutine* baseCoroutine;
+#ifdef PROFILE_OPS
+	OpProfile* profile;
+#endif
 };
 
 enum InterpretResult : uint8_t
 {
 	INTERPRET_OK,
 	INTERPRET_COMPILE_ERROR,
-	INTERPRET_RUNTIME_ERROR
+	INTERPRET_RUNTIME_ERROR,
+	// out of budget or, with vm->waitFd or vm->retry set, waiting; the script is suspended
+	// and resume() carries on from there
+	INTERPRET_YIELDED
 };
 
-VM* currentVM();
+uint64_t clockNanos();
 
 VM createVM();
 
 void freeVM(VM* vm);
 
+void adoptHeap(VM* vm, VM* from, Chunk* chunk);
+
 InterpretResult interpret(VM* vm, Chunk* chunk);
 InterpretResult interpret(VM* vm, const char* source);
 
+// Sets `chunk` up to run from its first instruction without running any of it. The
+// caller keeps the chunk alive until the script finishes; startScript() moves it into
+// the VM instead.
+void start(VM* vm, Chunk* chunk);
+void startScript(VM* vm, Chunk* chunk);
+
+// Runs the started script for about `budget` instructions (0 for no limit). The budget
+// is only checked on backward jumps and calls, so straight-line code can overrun it by
+// the length of a loop body. Returns INTERPRET_YIELDED if the script is still alive.
+InterpretResult resume(VM* vm, uint64_t budget);
+
 InterpretResult run(VM* vm);
 
+// Records the script about to run, so its imports resolve next to it.
+void setScriptPath(VM* vm, const std::string& path);
+
+// Calls `callee`, which sits below the top argCount values of the stack. A script function
+// gets a frame for run() to carry on in; a native runs here and leaves its result in place
+// of the callee. False after a runtime error.
+bool callValue(VM* vm, Value callee, int argCount);
+
+VMStats vmStats(VM* vm);
+
+// Rough cost of one vm->globals or exports entry besides its name's characters.
+#define GLOBAL_ENTRY_BYTES (sizeof(std::pair<const std::string, Value>) + 2 * sizeof(void*))
+
+// Sets `name` in `table` (vm->globals or a module's exports), charging a new entry to
+// HEAP_GLOBAL.
+void bindGlobal(VM* vm, std::unordered_map<std::string, Value>& table, const std::string& name, Value value);
+
+// Brings the HEAP_STACK charge in `*accounted` up to the capacity of `stack` and `frames`.
+void accountStack(VM* vm, ValueArray& stack, std::vector<CallFrame>& frames, size_t* accounted);
+
+// Prints `format` and a stack trace to vm->err and unwinds every frame. The caller then
+// returns INTERPRET_RUNTIME_ERROR, or false from a native.
+void runtimeError(VM* vm, const char* format...);
+
 uint32_t readbytes(VM* vm, uint32_t bytes);
\ No newline at end of file
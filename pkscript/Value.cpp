@@ -3,13 +3,17 @@
 
 void printValue(Value value)
 {
+	printValue(stdout, value);
+}
 
+void printValue(FILE* file, Value value)
+{
 	switch (value.type)
 	{
-	case VAL_BOOL: printf(AS_BOOL(value) ? "true" : "false"); break;
-	case VAL_NIL: printf("nil"); break;
-	case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-	case VAL_OBJ: printObject(value); break;
+	case VAL_BOOL: fputs(AS_BOOL(value) ? "true" : "false", file); break;
+	case VAL_NIL: fputs("nil", file); break;
+	case VAL_NUMBER: fprintf(file, "%g", AS_NUMBER(value)); break;
+	case VAL_OBJ: printObject(file, value); break;
 	}
 }
 
@@ -45,7 +49,7 @@ Value createObject(Obj* value)
 	return result;
 }
 
-bool isFalsey(Value& value)
+bool isFalsey(Value value)
 {
 	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
@@ -58,7 +62,10 @@ bool valuesEqual(Value a, Value b)
 	case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
 	case VAL_NIL: return true;
 	case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-	case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+	// strings are interned per heap, so a program's constant and the VM's own copy of
+	// the same text are different objects
+	case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b)
+		|| (IS_STRING(a) && IS_STRING(b) && AS_STRING(a)->string == AS_STRING(b)->string);
 	default: return false;
 	}
 }
\ No newline at end of file
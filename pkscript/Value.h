@@ -1,5 +1,6 @@
 #pragma once
 #include "pkscript.h"
+#include <cstdio>
 #include <vector>
 
 enum ValueType
@@ -41,10 +42,11 @@ Value createNil();
 Value createNumber(double value);
 Value createObject(Obj* value);
 
-bool isFalsey(Value& value);
+bool isFalsey(Value value);
 bool valuesEqual(Value a, Value b);
 
 
 using ValueArray = std::vector<Value>;
 
-void printValue(Value value);
\ No newline at end of file
+void printValue(Value value);
+void printValue(FILE* file, Value value);
\ No newline at end of file
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "VM.h"
+
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// A self-contained harness for the component microbenchmarks. Each benchmark body is
+// called with an iteration count; the harness doubles it until one call takes at least
+// --min-time, then takes --samples calls at that count and reports per-iteration times.
+//
+//   pkscript-micro-<name> [--samples N] [--min-time ms] [--filter text] [--csv | --json]
+
+struct MicroResult
+{
+	std::string name;
+	uint64_t iterations;
+	double medianNs;
+	double p95Ns;
+	// units of work per iteration (tokens, bytes, instructions...), for the items/s column
+	double items;
+};
+
+enum HarnessFormat
+{
+	FORMAT_TABLE,
+	FORMAT_CSV,
+	FORMAT_JSON,
+};
+
+struct Harness
+{
+	int samples;
+	double minTime;
+	std::string filter;
+	HarnessFormat format;
+	std::vector<MicroResult> results;
+};
+
+template <typename T>
+static inline void doNotOptimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile const void* sink;
+	sink = &value;
+#endif
+}
+
+static inline void initHarness(Harness* harness, int argc, const char* argv[])
+{
+	harness->samples = 15;
+	harness->minTime = 0.01;
+	harness->format = FORMAT_TABLE;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) harness->samples = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) harness->minTime = atof(argv[++i]) / 1e3;
+		else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) harness->filter = argv[++i];
+		else if (strcmp(argv[i], "--csv") == 0) harness->format = FORMAT_CSV;
+		else if (strcmp(argv[i], "--json") == 0) harness->format = FORMAT_JSON;
+		else
+		{
+			fprintf(stderr, "Usage: %s [--samples N] [--min-time ms] [--filter text] [--csv | --json]\n", argv[0]);
+			exit(64);
+		}
+	}
+}
+
+static inline double timeIterations(const std::function<void(uint64_t)>& body, uint64_t iterations)
+{
+	uint64_t started = clockNanos();
+	body(iterations);
+	return (double)(clockNanos() - started);
+}
+
+static inline void benchmark(Harness* harness, const std::string& name, double items,
+	const std::function<void(uint64_t)>& body)
+{
+	if (!harness->filter.empty() && name.find(harness->filter) == std::string::npos) return;
+
+	uint64_t iterations = 1;
+	while (timeIterations(body, iterations) < harness->minTime * 1e9 && iterations < (1ULL << 40))
+	{
+		iterations *= 2;
+	}
+
+	std::vector<double> perIteration;
+	for (int i = 0; i < harness->samples; i++)
+	{
+		perIteration.push_back(timeIterations(body, iterations) / iterations);
+	}
+	std::sort(perIteration.begin(), perIteration.end());
+
+	MicroResult result;
+	result.name = name;
+	result.iterations = iterations;
+	result.medianNs = perIteration[perIteration.size() / 2];
+	result.p95Ns = perIteration[std::min(perIteration.size() - 1, (size_t)(0.95 * (perIteration.size() - 1) + 0.5))];
+	result.items = items;
+	harness->results.push_back(result);
+	if (harness->format == FORMAT_TABLE) fprintf(stderr, "  %s\n", name.c_str());
+}
+
+static inline int finishHarness(Harness* harness)
+{
+	if (harness->format == FORMAT_CSV)
+	{
+		printf("name,iterations,median_ns,p95_ns,items_per_second\n");
+		for (MicroResult& result : harness->results)
+		{
+			printf("%s,%llu,%.3f,%.3f,%.0f\n", result.name.c_str(), (unsigned long long)result.iterations,
+				result.medianNs, result.p95Ns, result.items * 1e9 / result.medianNs);
+		}
+	}
+	else if (harness->format == FORMAT_JSON)
+	{
+		printf("[");
+		for (size_t i = 0; i < harness->results.size(); i++)
+		{
+			MicroResult& result = harness->results[i];
+			printf("%s\n  {\"name\": \"%s\", \"iterations\": %llu, \"median_ns\": %.3f, \"p95_ns\": %.3f, "
+				"\"items_per_second\": %.0f}", i == 0 ? "" : ",", result.name.c_str(),
+				(unsigned long long)result.iterations, result.medianNs, result.p95Ns,
+				result.items * 1e9 / result.medianNs);
+		}
+		printf("\n]\n");
+	}
+	else
+	{
+		printf("%-36s %14s %14s %14s\n", "benchmark", "median ns", "p95 ns", "items/s");
+		for (MicroResult& result : harness->results)
+		{
+			printf("%-36s %14.1f %14.1f %14.3e\n", result.name.c_str(), result.medianNs, result.p95Ns,
+				result.items * 1e9 / result.medianNs);
+		}
+	}
+	return 0;
+}
+
+// A script of roughly `bytes` bytes that uses most of the grammar: declarations,
+// arithmetic, strings, blocks, loops and function definitions.
+static inline std::string syntheticScript(size_t bytes)
+{
+	std::string source;
+	for (int i = 0; source.size() < bytes; i++)
+	{
+		std::string n = std::to_string(i);
+		source += "var value" + n + " = " + n + " * 2 + (value" + n + "_base - 1.5) / 3;\n";
+		source += "func helper" + n + "(a, b) { var c = a + b; if (c > 10) return c; return \"small\"; }\n";
+		source += "for (var i = 0; i < 10; i = i + 1) { print \"item\" + \"" + n + "\"; }\n";
+	}
+	return source;
+}
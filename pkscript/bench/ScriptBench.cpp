@@ -0,0 +1,105 @@
+#include "pkscript.h"
+#include "ScriptBench.h"
+#include "VM.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+std::vector<std::string> benchScripts(const std::string& directory)
+{
+	std::vector<std::string> scripts;
+	std::error_code error;
+	for (auto& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		if (entry.is_regular_file(error) && entry.path().extension() == ".pks")
+			scripts.push_back(entry.path().string());
+	}
+	std::sort(scripts.begin(), scripts.end());
+	return scripts;
+}
+
+double percentile(std::vector<double> samples, double fraction)
+{
+	if (samples.empty()) return 0;
+	std::sort(samples.begin(), samples.end());
+	size_t index = (size_t)(fraction * (samples.size() - 1) + 0.5);
+	return samples[std::min(index, samples.size() - 1)];
+}
+
+// Points stdout at /dev/null while the scripts run, so their output costs the same
+// every time and does not end up in the report.
+static int silenceStdout()
+{
+	fflush(stdout);
+#ifndef _WIN32
+	int saved = dup(1);
+	int null = open("/dev/null", O_WRONLY);
+	if (null >= 0)
+	{
+		dup2(null, 1);
+		close(null);
+	}
+	return saved;
+#else
+	return -1;
+#endif
+}
+
+static void restoreStdout(int saved)
+{
+	fflush(stdout);
+#ifndef _WIN32
+	if (saved < 0) return;
+	dup2(saved, 1);
+	close(saved);
+#endif
+}
+
+BenchResult runScriptBench(const std::string& path, const BenchOptions& options)
+{
+	BenchResult result;
+	result.name = std::filesystem::path(path).stem().string();
+	result.ok = false;
+	result.median = result.p95 = result.instructionsPerSecond = 0;
+	result.instructions = 0;
+
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	if (!in) return result;
+	std::stringstream text;
+	text << in.rdbuf();
+	std::string source = text.str();
+
+	uint64_t instructions = 0;
+	double measured = 0;
+	result.ok = true;
+	int saved = silenceStdout();
+	for (int i = 0; i < options.warmup + options.iterations && result.ok; i++)
+	{
+		VM vm = createVM();
+		uint64_t started = clockNanos();
+		result.ok = interpret(&vm, source.c_str()) == INTERPRET_OK;
+		double elapsed = (clockNanos() - started) / 1e9;
+
+		if (i >= options.warmup)
+		{
+			result.samples.push_back(elapsed);
+			instructions += vm.stats.instructions;
+			result.instructions = vm.stats.instructions;
+			measured += elapsed;
+		}
+		freeVM(&vm);
+	}
+	restoreStdout(saved);
+
+	result.median = percentile(result.samples, 0.5);
+	result.p95 = percentile(result.samples, 0.95);
+	if (measured > 0) result.instructionsPerSecond = instructions / measured;
+	return result;
+}
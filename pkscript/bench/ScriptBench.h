@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct BenchOptions
+{
+	int iterations;
+	int warmup;
+};
+
+// Timings are in seconds. ok is false when the script failed to compile or run.
+struct BenchResult
+{
+	std::string name;
+	bool ok;
+	std::vector<double> samples;
+	double median;
+	double p95;
+	double instructionsPerSecond;
+	// per run; deterministic for a given compiler, unlike the timings
+	uint64_t instructions;
+};
+
+// Sorted list of the .pks programs in `directory`.
+std::vector<std::string> benchScripts(const std::string& directory);
+
+// Runs the script `warmup + iterations` times in-process, each time in a fresh VM through
+// interpret(), so compiling is part of every sample. Anything the script prints is discarded.
+BenchResult runScriptBench(const std::string& path, const BenchOptions& options);
+
+double percentile(std::vector<double> samples, double fraction);
@@ -0,0 +1,79 @@
+#include "pkscript.h"
+#include "ScriptBench.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+static void usage()
+{
+    std::cerr << "Usage: pkscript-bench [-n iterations] [-w warmup] [--json] [script | directory ...]\n" << std::endl;
+    exit(64);
+}
+
+static void printJson(const std::vector<BenchResult>& results)
+{
+    printf("[");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& result = results[i];
+        printf("%s\n  {\"name\": \"%s\", \"ok\": %s, \"median\": %.9f, \"p95\": %.9f, \"ips\": %.0f}",
+            i == 0 ? "" : ",", result.name.c_str(), result.ok ? "true" : "false",
+            result.median, result.p95, result.instructionsPerSecond);
+    }
+    printf("\n]\n");
+}
+
+static void printTable(const std::vector<BenchResult>& results)
+{
+    printf("%-20s %12s %12s %14s\n", "script", "median ms", "p95 ms", "instr/s");
+    for (const BenchResult& result : results)
+    {
+        if (!result.ok)
+        {
+            printf("%-20s %12s\n", result.name.c_str(), "error");
+            continue;
+        }
+        printf("%-20s %12.3f %12.3f %14.3e\n", result.name.c_str(),
+            result.median * 1e3, result.p95 * 1e3, result.instructionsPerSecond);
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    BenchOptions options = { 20, 3 };
+    bool json = false;
+    std::vector<std::string> scripts;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) options.iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) options.warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0) json = true;
+        else if (argv[i][0] == '-') usage();
+        else
+        {
+            std::error_code error;
+            if (std::filesystem::is_directory(argv[i], error))
+            {
+                std::vector<std::string> found = benchScripts(argv[i]);
+                scripts.insert(scripts.end(), found.begin(), found.end());
+            }
+            else scripts.push_back(argv[i]);
+        }
+    }
+    if (options.iterations < 1 || options.warmup < 0) usage();
+    if (scripts.empty()) scripts = benchScripts(PKSCRIPT_BENCH_DIR);
+
+    std::vector<BenchResult> results;
+    bool failed = false;
+    for (const std::string& script : scripts)
+    {
+        results.push_back(runScriptBench(script, options));
+        failed |= !results.back().ok;
+    }
+
+    if (json) printJson(results);
+    else printTable(results);
+    return failed ? 70 : 0;
+}
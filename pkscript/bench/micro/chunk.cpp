@@ -0,0 +1,47 @@
+#include "Harness.h"
+#include "Chunk.h"
+
+#include <random>
+
+int main(int argc, const char* argv[])
+{
+	Harness harness;
+	initHarness(&harness, argc, argv);
+
+	// crosses the 1, 2 and 4 byte operand forms
+	for (uint32_t count : { 200, 60000, 1000000 })
+	{
+		benchmark(&harness, "writeConstant/" + std::to_string(count), count, [&](uint64_t iterations)
+		{
+			for (uint64_t i = 0; i < iterations; i++)
+			{
+				Chunk chunk;
+				for (uint32_t j = 0; j < count; j++) writeConstant(&chunk, createNumber(j), j / 4 + 1);
+				doNotOptimize(chunk.code.data());
+			}
+		});
+	}
+
+	for (int lines : { 100, 10000, 1000000 })
+	{
+		Chunk chunk;
+		for (int line = 1; line <= lines; line++)
+		{
+			for (int j = 0; j < 3; j++) writeChunk(&chunk, OP_NIL, line);
+		}
+		std::mt19937 random(42);
+		std::vector<size_t> offsets(4096);
+		for (size_t& offset : offsets) offset = random() % chunk.code.size();
+
+		benchmark(&harness, "getLine/" + std::to_string(lines) + " lines", (double)offsets.size(),
+			[&](uint64_t iterations)
+		{
+			for (uint64_t i = 0; i < iterations; i++)
+			{
+				for (size_t offset : offsets) doNotOptimize(getLine(&chunk, offset));
+			}
+		});
+	}
+
+	return finishHarness(&harness);
+}
@@ -0,0 +1,27 @@
+#include "Harness.h"
+#include "Compiler.h"
+
+// Items are source bytes, so items/s reads as compile throughput.
+int main(int argc, const char* argv[])
+{
+	Harness harness;
+	initHarness(&harness, argc, argv);
+
+	for (size_t bytes : { 1 << 10, 16 << 10, 256 << 10, 1 << 20 })
+	{
+		std::string text = syntheticScript(bytes);
+		benchmark(&harness, "compile/" + std::to_string(bytes >> 10) + "KB", (double)text.size(),
+			[&](uint64_t iterations)
+		{
+			for (uint64_t i = 0; i < iterations; i++)
+			{
+				VM vm = createVM();
+				Chunk chunk;
+				doNotOptimize(compile(&vm, text.c_str(), &chunk));
+				freeVM(&vm);
+			}
+		});
+	}
+
+	return finishHarness(&harness);
+}
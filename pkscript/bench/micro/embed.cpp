@@ -0,0 +1,71 @@
+#include "Harness.h"
+#include "Compiler.h"
+#include "Embed.h"
+
+#include <cstdio>
+
+#define BATCH_SIZE 256
+
+// Per-call cost of calling into a VM from the host. The source/ rows are what a host
+// without Embed.h had to do: compile a call expression and interpret it.
+int main(int argc, const char* argv[])
+{
+	Harness harness;
+	initHarness(&harness, argc, argv);
+
+	VM vm = createVM();
+	if (interpret(&vm, "func nop() { return nil; } func add(a, b) { return a + b; }") != INTERPRET_OK)
+	{
+		fprintf(stderr, "Could not define the benchmark functions.\n");
+		return 65;
+	}
+	Value nop, add;
+	findFunction(&vm, "nop", &nop);
+	findFunction(&vm, "add", &add);
+
+	benchmark(&harness, "invoke/nop", 1, [&](uint64_t iterations)
+	{
+		Value result;
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			pushCall(&vm, nop);
+			doNotOptimize(invoke(&vm, 0, &result));
+		}
+	});
+
+	benchmark(&harness, "invoke/add", 1, [&](uint64_t iterations)
+	{
+		Value result;
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			pushCall(&vm, add);
+			pushArgument(&vm, createNumber((double)i));
+			pushArgument(&vm, createNumber(1));
+			invoke(&vm, 2, &result);
+			doNotOptimize(result);
+		}
+	});
+
+	std::vector<Value> args(BATCH_SIZE * 2, createNumber(1));
+	std::vector<Value> results(BATCH_SIZE);
+	benchmark(&harness, "invokeBatch/add", BATCH_SIZE, [&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+			doNotOptimize(invokeBatch(&vm, add, 2, args.data(), BATCH_SIZE, results.data()));
+	});
+
+	Chunk chunk;
+	compile(&vm, "add(1, 1);", &chunk);
+	benchmark(&harness, "source/interpret-chunk", 1, [&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++) doNotOptimize(interpret(&vm, &chunk));
+	});
+
+	benchmark(&harness, "source/interpret-text", 1, [&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++) doNotOptimize(interpret(&vm, "add(1, 1);"));
+	});
+
+	freeVM(&vm);
+	return finishHarness(&harness);
+}
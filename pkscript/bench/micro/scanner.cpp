@@ -0,0 +1,45 @@
+#include "Harness.h"
+#include "Scanner.h"
+
+static int scanAll(const std::string& text)
+{
+	Source source;
+	sourceFromString(&source, text.data(), text.size());
+	Scanner scanner;
+	initScanner(&scanner, &source);
+	int tokens = 0;
+	while (scanToken(&scanner).type != TOKEN_EOF) tokens++;
+	return tokens;
+}
+
+int main(int argc, const char* argv[])
+{
+	Harness harness;
+	initHarness(&harness, argc, argv);
+
+	for (size_t bytes : { 1 << 10, 64 << 10, 1 << 20 })
+	{
+		std::string text = syntheticScript(bytes);
+		benchmark(&harness, "scanToken/" + std::to_string(bytes >> 10) + "KB", (double)scanAll(text),
+			[&](uint64_t iterations)
+		{
+			for (uint64_t i = 0; i < iterations; i++) doNotOptimize(scanAll(text));
+		});
+	}
+
+	std::string identifiers;
+	for (int i = 0; i < 4096; i++) identifiers += "identifier_" + std::to_string(i) + " ";
+	benchmark(&harness, "scanToken/identifiers", (double)scanAll(identifiers), [&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++) doNotOptimize(scanAll(identifiers));
+	});
+
+	std::string keywords;
+	for (int i = 0; i < 4096; i++) keywords += "var func for while if else return print ";
+	benchmark(&harness, "scanToken/keywords", (double)scanAll(keywords), [&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++) doNotOptimize(scanAll(keywords));
+	});
+
+	return finishHarness(&harness);
+}
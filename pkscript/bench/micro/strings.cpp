@@ -0,0 +1,45 @@
+#include "Harness.h"
+#include "Object.h"
+
+int main(int argc, const char* argv[])
+{
+	Harness harness;
+	initHarness(&harness, argc, argv);
+
+	const int count = 10000;
+	std::vector<std::string> texts;
+	for (int i = 0; i < count; i++) texts.push_back("string number " + std::to_string(i));
+
+	// every string is new, so each call allocates and interns
+	benchmark(&harness, "copyString/new", count, [&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			VM vm = createVM();
+			for (std::string& text : texts) doNotOptimize(copyString(&vm, text.data(), (int)text.size()));
+			freeVM(&vm);
+		}
+	});
+
+	VM interned = createVM();
+	for (std::string& text : texts) copyString(&interned, text.data(), (int)text.size());
+
+	benchmark(&harness, "copyString/interned", count, [&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			for (std::string& text : texts) doNotOptimize(copyString(&interned, text.data(), (int)text.size()));
+		}
+	});
+
+	benchmark(&harness, "takeString/interned", count, [&](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; i++)
+		{
+			for (std::string& text : texts) doNotOptimize(takeString(&interned, text));
+		}
+	});
+	freeVM(&interned);
+
+	return finishHarness(&harness);
+}
@@ -0,0 +1,64 @@
+#include "Harness.h"
+#include "Compiler.h"
+
+#include <cstdio>
+
+struct OpLoop
+{
+	const char* name;
+	const char* setup;
+	// repeated many times inside the loop body so the loop overhead stays small
+	const char* statement;
+};
+
+// Each loop is compiled once and re-run with interpret(); items are instructions, so
+// the median is nanoseconds per instruction averaged over the loop.
+static const OpLoop loops[] =
+{
+	{ "OP_ADD", "var a = 1; var b = 2;", "a + b + a + b + a + b + a + b;" },
+	{ "OP_MULTIPLY", "var a = 1; var b = 2;", "a * b * a * b * a * b * a * b;" },
+	{ "OP_GET_LOCAL", "var a = 1;", "a; a; a; a; a; a; a; a;" },
+	{ "OP_SET_LOCAL", "var a = 1;", "a = 1; a = 2; a = 3; a = 4;" },
+	{ "OP_CONSTANT", "", "1; 2; 3; 4; 5; 6; 7; 8;" },
+	{ "OP_NOT", "var a = true;", "!!!!!!!!a;" },
+	{ "OP_EQUAL", "var a = 1;", "a == a == a == a == a;" },
+	{ "OP_CALL", "func f() { return nil; }", "f(); f(); f(); f();" },
+};
+
+static std::string loopScript(const OpLoop& loop, bool global)
+{
+	std::string body;
+	for (int i = 0; i < 16; i++) body += loop.statement;
+	std::string script = std::string("for (var i = 0; i < 1000; i = i + 1) { ") + body + " }";
+	if (global) return std::string(loop.setup) + script;
+	// locals inside a block so GET_LOCAL/SET_LOCAL are what actually runs
+	return std::string("{ ") + loop.setup + " " + script + " }";
+}
+
+int main(int argc, const char* argv[])
+{
+	Harness harness;
+	initHarness(&harness, argc, argv);
+
+	for (const OpLoop& loop : loops)
+	{
+		std::string text = loopScript(loop, strcmp(loop.name, "OP_CALL") == 0);
+		VM vm = createVM();
+		Chunk chunk;
+		if (!compile(&vm, text.c_str(), &chunk))
+		{
+			fprintf(stderr, "Could not compile the %s loop.\n", loop.name);
+			return 65;
+		}
+		interpret(&vm, &chunk);
+		uint64_t instructions = vm.stats.instructions;
+
+		benchmark(&harness, std::string("run/") + loop.name, (double)instructions, [&](uint64_t iterations)
+		{
+			for (uint64_t i = 0; i < iterations; i++) doNotOptimize(interpret(&vm, &chunk));
+		});
+		freeVM(&vm);
+	}
+
+	return finishHarness(&harness);
+}
@@ -0,0 +1,230 @@
+#include "pkscript.h"
+#include "ScriptBench.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+
+// Compares the bench/ scripts against a stored baseline. Every script is measured in
+// several rounds; a script regresses when the median of the round medians is slower
+// than the baseline by more than the tolerance and even the fastest round is slower
+// than the baseline, so a single noisy round cannot fail the check. Instruction counts
+// are deterministic and are compared exactly.
+
+struct Baseline
+{
+    double median;
+    double tolerance;
+    uint64_t instructions;
+};
+
+struct Measurement
+{
+    std::string name;
+    bool ok;
+    double median;
+    double fastest;
+    double spread;
+    uint64_t instructions;
+};
+
+static void usage()
+{
+    std::cerr << "Usage: pkscript-perfcheck [--baseline file.json] [--update] [--tolerance percent]\n"
+        "                          [--rounds N] [-n iterations] [-w warmup] [script ...]\n" << std::endl;
+    exit(64);
+}
+
+static bool numberField(const std::string& object, const char* key, double* value)
+{
+    std::string quoted = std::string("\"") + key + "\":";
+    size_t at = object.find(quoted);
+    if (at == std::string::npos) return false;
+    *value = strtod(object.c_str() + at + quoted.size(), nullptr);
+    return true;
+}
+
+static bool stringField(const std::string& object, const char* key, std::string* value)
+{
+    std::string quoted = std::string("\"") + key + "\": \"";
+    size_t at = object.find(quoted);
+    if (at == std::string::npos) return false;
+    size_t start = at + quoted.size();
+    size_t end = object.find('"', start);
+    if (end == std::string::npos) return false;
+    *value = object.substr(start, end - start);
+    return true;
+}
+
+// Reads the file written by writeBaseline(): one flat object per benchmark.
+static bool readBaseline(const std::string& path, double defaultTolerance,
+    std::unordered_map<std::string, Baseline>& baselines)
+{
+    std::ifstream in(path);
+    if (!in) return false;
+    std::stringstream text;
+    text << in.rdbuf();
+    std::string json = text.str();
+
+    for (size_t open = json.find('{'); open != std::string::npos; open = json.find('{', open + 1))
+    {
+        size_t close = json.find('}', open);
+        if (close == std::string::npos) return false;
+        std::string object = json.substr(open, close - open);
+
+        std::string name;
+        Baseline baseline;
+        double instructions = 0;
+        if (!stringField(object, "name", &name) || !numberField(object, "median", &baseline.median)) return false;
+        if (!numberField(object, "tolerance", &baseline.tolerance)) baseline.tolerance = defaultTolerance;
+        numberField(object, "instructions", &instructions);
+        baseline.instructions = (uint64_t)instructions;
+        baselines[name] = baseline;
+    }
+    return true;
+}
+
+static bool writeBaseline(const std::string& path, const std::vector<Measurement>& measurements,
+    std::unordered_map<std::string, Baseline>& previous)
+{
+    FILE* out = fopen(path.c_str(), "w");
+    if (out == nullptr) return false;
+    fprintf(out, "[");
+    for (size_t i = 0; i < measurements.size(); i++)
+    {
+        const Measurement& measurement = measurements[i];
+        fprintf(out, "%s\n  {\"name\": \"%s\", \"median\": %.9f, \"instructions\": %llu", i == 0 ? "" : ",",
+            measurement.name.c_str(), measurement.median, (unsigned long long)measurement.instructions);
+        // hand-tuned tolerances survive an update
+        auto found = previous.find(measurement.name);
+        if (found != previous.end() && found->second.tolerance >= 0)
+            fprintf(out, ", \"tolerance\": %.3f", found->second.tolerance);
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n]\n");
+    return fclose(out) == 0;
+}
+
+static Measurement measure(const std::string& script, const BenchOptions& options, int rounds)
+{
+    Measurement measurement;
+    measurement.ok = true;
+    std::vector<double> medians;
+    for (int round = 0; round < rounds && measurement.ok; round++)
+    {
+        BenchResult result = runScriptBench(script, options);
+        measurement.name = result.name;
+        measurement.ok = result.ok;
+        measurement.instructions = result.instructions;
+        medians.push_back(result.median);
+    }
+    measurement.median = percentile(medians, 0.5);
+    measurement.fastest = percentile(medians, 0);
+    measurement.spread = measurement.median > 0 ? (percentile(medians, 1) - measurement.fastest) / measurement.median : 0;
+    return measurement;
+}
+
+int main(int argc, const char* argv[])
+{
+    BenchOptions options = { 10, 2 };
+    int rounds = 5;
+    double tolerance = 0.10;
+    bool update = false;
+    std::string baselinePath = std::string(PKSCRIPT_BENCH_DIR) + "/baseline.json";
+    std::vector<std::string> scripts;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--update") == 0) update = true;
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) tolerance = atof(argv[++i]) / 100;
+        else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) options.iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) options.warmup = atoi(argv[++i]);
+        else if (argv[i][0] == '-') usage();
+        else scripts.push_back(argv[i]);
+    }
+    if (rounds < 1 || options.iterations < 1 || options.warmup < 0 || tolerance < 0) usage();
+    if (scripts.empty()) scripts = benchScripts(PKSCRIPT_BENCH_DIR);
+
+    // tolerances only come from the file when they were written there explicitly
+    std::unordered_map<std::string, Baseline> baselines;
+    bool haveBaseline = readBaseline(baselinePath, -1, baselines);
+    if (!haveBaseline && !update)
+    {
+        std::cerr << "Could not read baseline " << baselinePath << "; run with --update to create it." << std::endl;
+        return 74;
+    }
+
+    std::vector<Measurement> measurements;
+    for (const std::string& script : scripts)
+    {
+        measurements.push_back(measure(script, options, rounds));
+    }
+
+    if (update)
+    {
+        if (!writeBaseline(baselinePath, measurements, baselines))
+        {
+            std::cerr << "Could not write baseline " << baselinePath << "." << std::endl;
+            return 74;
+        }
+        printf("Wrote %zu results to %s.\n", measurements.size(), baselinePath.c_str());
+        return 0;
+    }
+
+    int regressions = 0;
+    printf("%-16s %12s %12s %9s %8s %8s  %s\n", "script", "baseline ms", "current ms", "change", "spread", "limit", "status");
+    for (const Measurement& measurement : measurements)
+    {
+        auto found = baselines.find(measurement.name);
+        if (!measurement.ok)
+        {
+            printf("%-16s %12s %12s %9s %8s %8s  %s\n", measurement.name.c_str(), "", "", "", "", "", "ERROR");
+            regressions++;
+            continue;
+        }
+        if (found == baselines.end())
+        {
+            printf("%-16s %12s %12.3f %9s %8s %8s  %s\n", measurement.name.c_str(), "-",
+                measurement.median * 1e3, "", "", "", "new");
+            continue;
+        }
+
+        const Baseline& baseline = found->second;
+        double limit = baseline.tolerance >= 0 ? baseline.tolerance : tolerance;
+        double change = baseline.median > 0 ? measurement.median / baseline.median - 1 : 0;
+        const char* status = "ok";
+        if (change > limit && measurement.fastest > baseline.median)
+        {
+            status = "SLOWER";
+            regressions++;
+        }
+        else if (baseline.instructions != 0 && measurement.instructions > baseline.instructions)
+        {
+            status = "MORE INSTRUCTIONS";
+            regressions++;
+        }
+        else if (change < -limit)
+        {
+            status = "faster";
+        }
+        printf("%-16s %12.3f %12.3f %+8.1f%% %7.1f%% %7.1f%%  %s\n", measurement.name.c_str(),
+            baseline.median * 1e3, measurement.median * 1e3, change * 100, measurement.spread * 100,
+            limit * 100, status);
+        if (strcmp(status, "MORE INSTRUCTIONS") == 0)
+        {
+            printf("%-16s %12llu %12llu instructions per run\n", "",
+                (unsigned long long)baseline.instructions, (unsigned long long)measurement.instructions);
+        }
+    }
+
+    if (regressions > 0)
+    {
+        printf("%d benchmark(s) regressed.\n", regressions);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "pkscript.h"
+#include "Program.h"
+#include "ThreadPool.h"
+#include "VM.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+// Runs many independent VMs on all cores at once. Every VM imports the same module
+// (so they race on its .pkc cache), calls lazily compiled functions and builds strings,
+// then leaves a number in the global 'result' that is checked against the C++ answer.
+// With --shared they all run one Program compiled up front instead of compiling their own,
+// then a second one on the same VM. Each VM builds "hello" itself before any of that, so
+// its own string has to keep comparing equal to the programs' constants. The programs
+// are released before the VMs, so the last VM freed on a worker thread frees each one.
+
+static const char* MODULE_SOURCE =
+    "func twice(x) { return x * 2; }\n"
+    "var greeting = \"hello\";\n";
+
+static int fibArgument(int n)
+{
+    return 10 + n / 40 % 8;
+}
+
+static std::string scriptFor(const std::string& module, int n)
+{
+    return "import \"" + module + "\";\n"
+        "var n = " + std::to_string(n) + ";\n"
+        "var k = " + std::to_string(fibArgument(n)) + ";\n"
+        "func fib(k) { if (k < 2) return k; return fib(k - 1) + fib(k - 2); }\n"
+        "var text = \"\";\n"
+        "var sum = 0;\n"
+        "for (var i = 0; i < n; i = i + 1) { sum = sum + twice(i); text = text + greeting; }\n"
+        "var result = sum + fib(k);\n"
+        "if (text == greeting) result = -1;\n"
+        "if (built != \"hello\" or built != greeting) result = -2;\n";
+}
+
+static double expectedFor(int n)
+{
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += 2 * i;
+    int k = fibArgument(n);
+    double a = 0, b = 1;
+    for (int i = 0; i < k; i++)
+    {
+        double next = a + b;
+        a = b;
+        b = next;
+    }
+    return sum + a;
+}
+
+static void usage()
+{
+    std::cerr << "Usage: pkscript-stress [-v vms] [-t threads] [--shared]\n" << std::endl;
+    exit(64);
+}
+
+int main(int argc, const char* argv[])
+{
+    int vms = 400;
+    unsigned threads = workerCount();
+    bool shared = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) vms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) threads = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--shared") == 0) shared = true;
+        else usage();
+    }
+    if (vms < 1 || threads < 1) usage();
+
+    std::error_code error;
+    std::filesystem::path directory = std::filesystem::temp_directory_path(error) / "pkscript-stress";
+    std::filesystem::create_directories(directory, error);
+    std::string module = (directory / "helper.pks").string();
+    std::filesystem::remove(directory / "helper.pkc", error);
+    {
+        std::ofstream out(module);
+        out << MODULE_SOURCE;
+    }
+
+    // one program per distinct n, shared by every VM that uses that n
+    std::vector<Program*> programs;
+    if (shared)
+    {
+        for (int variant = 0; variant < 50; variant++)
+        {
+            programs.push_back(compileProgram(scriptFor(module, 200 + variant * 40).c_str()));
+            if (programs.back() == nullptr) return 65;
+        }
+    }
+
+    std::atomic<int> failures(0);
+    std::vector<VM*> finished((size_t)vms);
+    uint64_t started = clockNanos();
+    parallelFor((size_t)vms, threads, [&](size_t i)
+    {
+        int n = 200 + (int)(i % 50) * 40;
+
+        VM* vm = new VM(createVM());
+        bool ok = interpret(vm, "var built = \"hel\" + \"lo\";") == INTERPRET_OK;
+        if (shared)
+        {
+            ok = ok && interpret(vm, programs[(i + 1) % 50]) == INTERPRET_OK;
+            ok = ok && interpret(vm, programs[i % 50]) == INTERPRET_OK;
+        }
+        else ok = ok && interpret(vm, scriptFor(module, n).c_str()) == INTERPRET_OK;
+        auto result = vm->globals.find("result");
+        ok = ok && result != vm->globals.end() && IS_NUMBER(result->second)
+            && AS_NUMBER(result->second) == expectedFor(n);
+        if (!ok)
+        {
+            failures++;
+            fprintf(stderr, "VM %zu (n = %d) produced the wrong result.\n", i, n);
+        }
+        finished[i] = vm;
+    });
+    for (Program* program : programs) freeProgram(program);
+    parallelFor((size_t)vms, threads, [&](size_t i)
+    {
+        freeVM(finished[i]);
+        delete finished[i];
+    });
+    double seconds = (clockNanos() - started) / 1e9;
+
+    printf("%d VMs on %u threads in %.3f s, %d failed\n", vms, threads, seconds, failures.load());
+    std::filesystem::remove_all(directory, error);
+    return failures == 0 ? 0 : 70;
+}
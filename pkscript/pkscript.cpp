@@ -1,9 +1,31 @@
 #include "pkscript.h"
 
+#include "Cache.h"
 #include "Chunk.h"
+#include "Compiler.h"
 #include "Debug.h"
+#include "EventLoop.h"
+#include "HeapProfile.h"
+#include "Natives.h"
+#include "Profiler.h"
+#include "Sampler.h"
+#include "Snapshot.h"
+#include "Scheduler.h"
+#include "Server.h"
+#include "Trace.h"
+#include "Source.h"
+#include "ThreadPool.h"
 #include "VM.h"
 
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 static void repl(VM* vm)
 {
     std::cout << "type 'exit' to exit REPL\n";
@@ -32,52 +54,750 @@ static void repl(VM* vm)
     } while (inputLine != "exit");
 }
 
-static std::string readFile(std::string path)
+static void checkFile(FileStatus status, const std::string& path)
 {
-    std::string source;
-    std::ifstream in(path, std::ios::in | std::ios::ate);
-    if (in)
-    {
-        source.resize(in.tellg());
-        in.seekg(0, std::ios::beg);
-        in.read(&source[0], source.size());
-        in.close();
-    }
-    else
+    if (status == FILE_NOT_FOUND)
     {
         std::cerr << "Could not open file " << path << "." << std::endl;
         exit(74);
     }
-    return source;
+    if (status == FILE_COMPILE_ERROR) exit(65);
 }
 
-static void runFile(VM* vm, std::string path)
+static void checkResult(InterpretResult result)
 {
-    std::string source = readFile(path);
-    InterpretResult result = interpret(vm, source.c_str());
-
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
+static void runFile(VM* vm, std::string path, bool useCache)
+{
+    Chunk chunk;
+    checkFile(compileFile(vm, path, useCache, &chunk), path);
+    setScriptPath(vm, path);
+    checkResult(interpret(vm, &chunk));
+}
+
+struct CompileUnit
+{
+    VM vm;
+    Chunk chunk;
+    FileStatus status;
+};
+
+// Compiles every file on its own thread into its own heap, then links the heaps into
+// `vm` and runs the chunks in command line order, as if the files were concatenated.
+static void runFiles(VM* vm, const std::vector<std::string>& paths, bool useCache)
+{
+    std::vector<CompileUnit> units(paths.size());
+    parallelFor(units.size(), workerCount(), [&](size_t i)
+    {
+        units[i].vm = createVM();
+        units[i].vm.collectStats = vm->collectStats;
+        units[i].vm.stripLines = vm->stripLines;
+        units[i].status = compileFile(&units[i].vm, paths[i], useCache, &units[i].chunk);
+    });
+
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        checkFile(units[i].status, paths[i]);
+    }
+    for (CompileUnit& unit : units)
+    {
+        adoptHeap(vm, &unit.vm, &unit.chunk);
+    }
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        setScriptPath(vm, paths[i]);
+        checkResult(interpret(vm, &units[i].chunk));
+    }
+}
+
+static void addPath(std::vector<std::string>& paths, const char* path)
+{
+    std::error_code error;
+    if (!std::filesystem::is_directory(path, error))
+    {
+        paths.push_back(path);
+        return;
+    }
+
+    std::vector<std::string> scripts;
+    for (auto& entry : std::filesystem::directory_iterator(path, error))
+    {
+        if (entry.is_regular_file(error) && entry.path().extension() == ".pks")
+            scripts.push_back(entry.path().string());
+    }
+    std::sort(scripts.begin(), scripts.end());
+    paths.insert(paths.end(), scripts.begin(), scripts.end());
+}
+
+// Collects everything a batch script writes, so scripts running side by side do not
+// interleave their output.
+struct Capture
+{
+    FILE* file;
+    char* data;
+    size_t size;
+};
+
+static bool openCapture(Capture* capture)
+{
+    capture->data = nullptr;
+    capture->size = 0;
+#ifndef _WIN32
+    capture->file = open_memstream(&capture->data, &capture->size);
+#else
+    capture->file = tmpfile();
+#endif
+    return capture->file != nullptr;
+}
+
+static std::string closeCapture(Capture* capture)
+{
+    std::string text;
+#ifndef _WIN32
+    fclose(capture->file);
+    text.assign(capture->data, capture->size);
+    free(capture->data);
+#else
+    fseek(capture->file, 0, SEEK_END);
+    text.resize((size_t)ftell(capture->file));
+    rewind(capture->file);
+    text.resize(fread(&text[0], 1, text.size(), capture->file));
+    fclose(capture->file);
+#endif
+    return text;
+}
+
+struct BatchScript
+{
+    std::string path;
+    std::string output;
+    std::string errors;
+    int status;
+    uint64_t started;
+    uint64_t nanos;
+    bool done;
+    VM vm;
+    Capture out;
+    Capture err;
+};
+
+struct BatchOptions
+{
+    bool useCache;
+    bool stripLines;
+    uint64_t heapLimit;
+    // instructions per turn with --slice; 0 runs every script to the end in one go
+    uint64_t slice;
+    // --async: each thread runs an event loop, so scripts waiting on I/O step aside
+    bool async;
+    // --restore: the image every script's VM starts from
+    std::string restorePath;
+    // --io: scripts get the file and socket natives
+    bool io;
+};
+
+static void finishBatchScript(BatchScript* script, int status)
+{
+    freeVM(&script->vm);
+    script->status = status;
+    script->output = closeCapture(&script->out);
+    script->errors = closeCapture(&script->err);
+    script->nanos = clockNanos() - script->started;
+}
+
+// Compiles a script into a VM of its own and starts it. If it cannot run at all it is
+// finished on the spot, with the exit code a single-file run would have used.
+static bool prepareBatchScript(BatchScript* script, const BatchOptions& options)
+{
+    script->started = clockNanos();
+    if (!openCapture(&script->out) || !openCapture(&script->err))
+    {
+        std::cerr << "Could not capture the output of " << script->path << "." << std::endl;
+        exit(74);
+    }
+
+    script->vm = createVM();
+    script->vm.useCache = options.useCache;
+    script->vm.stripLines = options.stripLines;
+    script->vm.heapLimit = options.heapLimit;
+    script->vm.out = script->out.file;
+    script->vm.err = script->err.file;
+    if (options.io) defineIoNatives(&script->vm);
+    if (!options.restorePath.empty() && !loadSnapshot(&script->vm, options.restorePath))
+    {
+        fprintf(script->err.file, "Could not restore snapshot %s.\n", options.restorePath.c_str());
+        finishBatchScript(script, 74);
+        return false;
+    }
+
+    Chunk chunk;
+    FileStatus status = compileFile(&script->vm, script->path, options.useCache, &chunk);
+    if (status == FILE_NOT_FOUND)
+    {
+        fprintf(script->err.file, "Could not open file %s.\n", script->path.c_str());
+        finishBatchScript(script, 74);
+        return false;
+    }
+    if (status == FILE_COMPILE_ERROR)
+    {
+        finishBatchScript(script, 65);
+        return false;
+    }
+    setScriptPath(&script->vm, script->path);
+    startScript(&script->vm, &chunk);
+    return true;
+}
+
+// The codes checkResult() exits with: an import that fails to compile is still 65.
+static int exitCode(InterpretResult result)
+{
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+static double latencyPercentile(std::vector<double> samples, double fraction)
+{
+    if (samples.empty()) return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t index = (size_t)(fraction * (samples.size() - 1) + 0.5);
+    return samples[std::min(index, samples.size() - 1)];
+}
+
+// --jobs: every script gets its own VM and the scripts run on `jobs` threads. Output is
+// written in input order as soon as a script and all the ones before it have finished.
+// With a slice the scripts are all started up front and take turns on the threads, so
+// a script that never ends cannot hold up the rest; latency then counts from the start
+// of the batch. With --async, script i goes to the event loop of thread i % jobs, so the
+// scripts that have to talk to each other over pipes or sockets must share a thread.
+// Returns the highest exit code of any script.
+static int runBatch(const std::vector<std::string>& paths, unsigned jobs, const BatchOptions& options)
+{
+    std::vector<BatchScript> scripts(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        scripts[i].path = paths[i];
+        scripts[i].status = 0;
+        scripts[i].nanos = 0;
+        scripts[i].done = false;
+    }
+
+    std::mutex flushLock;
+    size_t flushed = 0;
+    auto flush = [&](BatchScript* finished)
+    {
+        std::lock_guard<std::mutex> guard(flushLock);
+        finished->done = true;
+        for (; flushed < scripts.size() && scripts[flushed].done; flushed++)
+        {
+            BatchScript& script = scripts[flushed];
+            fwrite(script.output.data(), 1, script.output.size(), stdout);
+            fflush(stdout);
+            fwrite(script.errors.data(), 1, script.errors.size(), stderr);
+            script.output.clear();
+            script.errors.clear();
+        }
+    };
+
+    uint64_t started = clockNanos();
+    if (options.async)
+    {
+        parallelFor(jobs, jobs, [&](size_t thread)
+        {
+            std::unordered_map<VM*, BatchScript*> owners;
+            EventLoop* loop = newEventLoop(options.slice, [&](VM* vm, InterpretResult result)
+            {
+                BatchScript* script = owners.at(vm);
+                finishBatchScript(script, exitCode(result));
+                flush(script);
+            });
+            for (size_t i = thread; i < scripts.size(); i += jobs)
+            {
+                if (prepareBatchScript(&scripts[i], options))
+                {
+                    owners.emplace(&scripts[i].vm, &scripts[i]);
+                    addScript(loop, &scripts[i].vm);
+                }
+                else
+                {
+                    flush(&scripts[i]);
+                }
+            }
+            runEventLoop(loop);
+            freeEventLoop(loop);
+        });
+    }
+    else if (options.slice == 0)
+    {
+        parallelFor(scripts.size(), jobs, [&](size_t i)
+        {
+            BatchScript* script = &scripts[i];
+            if (prepareBatchScript(script, options))
+            {
+                finishBatchScript(script, exitCode(resume(&script->vm, 0)));
+            }
+            flush(script);
+        });
+    }
+    else
+    {
+        std::unordered_map<VM*, BatchScript*> owners;
+        for (BatchScript& script : scripts)
+        {
+            if (prepareBatchScript(&script, options))
+                owners.emplace(&script.vm, &script);
+            else
+                flush(&script);
+        }
+
+        Scheduler* scheduler = newScheduler(jobs, options.slice, [&](VM* vm, InterpretResult result)
+        {
+            BatchScript* script = owners.at(vm);
+            finishBatchScript(script, exitCode(result));
+            flush(script);
+        });
+        for (BatchScript& script : scripts)
+        {
+            if (owners.count(&script.vm) != 0) schedule(scheduler, &script.vm);
+        }
+        freeScheduler(scheduler);
+    }
+    double wall = (clockNanos() - started) / 1e9;
+
+    int worst = 0;
+    size_t failed = 0;
+    std::vector<double> latencies;
+    for (BatchScript& script : scripts)
+    {
+        latencies.push_back(script.nanos / 1e6);
+        if (script.status == 0) continue;
+        fprintf(stderr, "[exit %d] %s\n", script.status, script.path.c_str());
+        worst = std::max(worst, script.status);
+        failed++;
+    }
+
+    fprintf(stderr, "== batch ==\n");
+    fprintf(stderr, "scripts           %12zu (%zu failed)\n", scripts.size(), failed);
+    fprintf(stderr, "jobs              %12u\n", jobs);
+    fprintf(stderr, "wall              %12.3f ms\n", wall * 1e3);
+    fprintf(stderr, "throughput        %12.1f scripts/s\n", wall > 0 ? scripts.size() / wall : 0.0);
+    fprintf(stderr, "latency p50       %12.3f ms\n", latencyPercentile(latencies, 0.50));
+    fprintf(stderr, "latency p95       %12.3f ms\n", latencyPercentile(latencies, 0.95));
+    fprintf(stderr, "latency p99       %12.3f ms\n", latencyPercentile(latencies, 0.99));
+    fprintf(stderr, "latency max       %12.3f ms\n", latencyPercentile(latencies, 1.0));
+    return worst;
+}
+
+// One script per line. Blank lines and lines starting with '#' are skipped; relative
+// paths are taken from the manifest's directory.
+static bool readManifest(std::vector<std::string>& paths, const char* manifest)
+{
+    std::ifstream in(manifest);
+    if (!in) return false;
+    std::filesystem::path base = std::filesystem::path(manifest).parent_path();
+    std::string line;
+    while (std::getline(in, line))
+    {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        std::filesystem::path path(line);
+        if (path.is_relative() && !base.empty()) path = base / path;
+        addPath(paths, path.string().c_str());
+    }
+    return true;
+}
+
+// Parses a byte count with an optional K, M or G suffix. Returns 0 when malformed.
+static uint64_t parseSize(const char* text)
+{
+    char* end;
+    uint64_t size = strtoull(text, &end, 10);
+    switch (*end)
+    {
+    case 'K': case 'k': size <<= 10; end++; break;
+    case 'M': case 'm': size <<= 20; end++; break;
+    case 'G': case 'g': size <<= 30; end++; break;
+    }
+    return *end == '\0' ? size : 0;
+}
+
+static void usage()
+{
+    std::cerr << "Usage: pkscript [--io] [--no-cache] [--strip-lines] [--profile-ops[=out.json]] [--profile-lines[=out.folded]]\n"
+        "                [--stats[=json]] [--trace[=out.pkt]] [--max-heap=bytes[K|M|G]]\n"
+        "                [--heap-profile[=out.txt]] [--heap-sample=bytes[K|M|G]]\n"
+        "                [--snapshot=out.pki] [--restore=in.pki] [path | directory ...]\n"
+        "       pkscript --jobs N [--slice instructions] [--async] [--manifest file] [--io] [--no-cache]\n"
+        "                [--strip-lines] [--max-heap=bytes] [--restore=in.pki] [path | directory ...]\n"
+        "       pkscript --serve socket [--workers N] [--max-requests N] [--entry name] [--io] [--no-cache]\n"
+        "                [--max-heap=bytes] [--restore=in.pki] [path]\n"
+        "       pkscript --decode-trace file.pkt\n" << std::endl;
+    exit(64);
+}
+
+static VM* statsVM = nullptr;
+static bool statsJson = false;
+
+static void reportStats()
+{
+    if (statsVM == nullptr) return;
+    VMStats stats = vmStats(statsVM);
+    statsVM = nullptr;
+
+    if (statsJson)
+    {
+        fprintf(stderr, "{\"scan_ns\": %llu, \"compile_ns\": %llu, \"execute_ns\": %llu, "
+            "\"bytecode_bytes\": %llu, \"constants\": %llu, \"instructions\": %llu, "
+            "\"objects_allocated\": %llu, \"strings_allocated\": %llu, \"interned_strings\": %llu, "
+            "\"bytes_allocated\": %llu, \"peak_bytes\": %llu, \"string_bytes\": %llu, \"function_bytes\": %llu, "
+            "\"intern_bytes\": %llu, \"chunk_bytes\": %llu, \"coroutine_bytes\": %llu, \"stack_bytes\": %llu, "
+            "\"global_bytes\": %llu, \"task_bytes\": %llu}\n",
+            (unsigned long long)stats.scanTime, (unsigned long long)stats.compileTime,
+            (unsigned long long)stats.executeTime, (unsigned long long)stats.bytecodeBytes,
+            (unsigned long long)stats.constants, (unsigned long long)stats.instructions,
+            (unsigned long long)stats.objectsAllocated, (unsigned long long)stats.stringsAllocated,
+            (unsigned long long)stats.internedStrings, (unsigned long long)stats.bytesAllocated,
+            (unsigned long long)stats.peakBytes, (unsigned long long)stats.heapBytes[HEAP_STRING],
+            (unsigned long long)stats.heapBytes[HEAP_FUNCTION], (unsigned long long)stats.heapBytes[HEAP_INTERN],
+            (unsigned long long)stats.heapBytes[HEAP_CHUNK], (unsigned long long)stats.heapBytes[HEAP_COROUTINE],
+            (unsigned long long)stats.heapBytes[HEAP_STACK], (unsigned long long)stats.heapBytes[HEAP_GLOBAL],
+            (unsigned long long)stats.heapBytes[HEAP_TASK]);
+        return;
+    }
+    fprintf(stderr, "== stats ==\n");
+    fprintf(stderr, "scan              %12.3f ms\n", stats.scanTime / 1e6);
+    fprintf(stderr, "compile           %12.3f ms\n", stats.compileTime / 1e6);
+    fprintf(stderr, "execute           %12.3f ms\n", stats.executeTime / 1e6);
+    fprintf(stderr, "bytecode          %12llu bytes\n", (unsigned long long)stats.bytecodeBytes);
+    fprintf(stderr, "constants         %12llu\n", (unsigned long long)stats.constants);
+    fprintf(stderr, "instructions      %12llu\n", (unsigned long long)stats.instructions);
+    fprintf(stderr, "objects allocated %12llu\n", (unsigned long long)stats.objectsAllocated);
+    fprintf(stderr, "strings allocated %12llu\n", (unsigned long long)stats.stringsAllocated);
+    fprintf(stderr, "interned strings  %12llu\n", (unsigned long long)stats.internedStrings);
+    fprintf(stderr, "heap in use       %12llu bytes\n", (unsigned long long)stats.bytesAllocated);
+    fprintf(stderr, "peak heap         %12llu bytes\n", (unsigned long long)stats.peakBytes);
+    fprintf(stderr, "  strings         %12llu bytes\n", (unsigned long long)stats.heapBytes[HEAP_STRING]);
+    fprintf(stderr, "  functions       %12llu bytes\n", (unsigned long long)stats.heapBytes[HEAP_FUNCTION]);
+    fprintf(stderr, "  intern table    %12llu bytes\n", (unsigned long long)stats.heapBytes[HEAP_INTERN]);
+    fprintf(stderr, "  chunks          %12llu bytes\n", (unsigned long long)stats.heapBytes[HEAP_CHUNK]);
+    fprintf(stderr, "  coroutines      %12llu bytes\n", (unsigned long long)stats.heapBytes[HEAP_COROUTINE]);
+    fprintf(stderr, "  stacks          %12llu bytes\n", (unsigned long long)stats.heapBytes[HEAP_STACK]);
+    fprintf(stderr, "  globals         %12llu bytes\n", (unsigned long long)stats.heapBytes[HEAP_GLOBAL]);
+    fprintf(stderr, "  tasks, channels %12llu bytes\n", (unsigned long long)stats.heapBytes[HEAP_TASK]);
+}
+
+static VM* tracedVM = nullptr;
 
+static void reportTrace()
+{
+    if (tracedVM == nullptr) return;
+    closeTrace(tracedVM->trace);
+    tracedVM->trace = nullptr;
+    tracedVM = nullptr;
+}
+
+static VM* heapProfiledVM = nullptr;
+
+static void reportHeapProfile()
+{
+    if (heapProfiledVM == nullptr) return;
+    if (!dumpHeapProfile(heapProfiledVM))
+    {
+        std::cerr << "Could not write heap profile to " << heapProfiledVM->heapProfile->path << "." << std::endl;
+    }
+    heapProfiledVM = nullptr;
+}
+
+static void requestHeapDump(int)
+{
+    heapDumpRequests++;
+}
+
+static std::string samplePath;
+
+static void reportSamples()
+{
+    if (samplePath.empty()) return;
+    stopSampler();
+    if (!writeSamples(samplePath))
+    {
+        std::cerr << "Could not write samples to " << samplePath << "." << std::endl;
+    }
+    samplePath.clear();
+}
+
+static OpProfile* opProfile = nullptr;
+static std::string opProfilePath;
+
+#ifdef PROFILE_OPS
+// Registered with atexit so the report is also written when a script fails.
+static void reportOpProfile()
+{
+    if (opProfilePath.empty())
+    {
+        printOpProfile(opProfile, stderr);
+    }
+    else if (!writeOpProfileJson(opProfile, opProfilePath))
+    {
+        std::cerr << "Could not write profile to " << opProfilePath << "." << std::endl;
+    }
+}
+#endif
 
 int main(int argc, const char* argv[])
 {
+    bool useCache = true;
+    bool stats = false;
+    bool stripLines = false;
+    uint64_t heapLimit = 0;
+    std::string heapProfilePath;
+    uint64_t heapSample = HEAP_SAMPLE_INTERVAL;
+    std::string tracePath;
+    bool directory = false;
+    unsigned jobs = 0;
+    uint64_t slice = 0;
+    bool async = false;
+    bool io = false;
+    std::string snapshotPath;
+    std::string restorePath;
+    std::string servePath;
+    ServeOptions serveOptions = { 0, 0, "handle" };
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-cache") == 0) useCache = false;
+        else if (strcmp(argv[i], "--strip-lines") == 0) stripLines = true;
+        else if (strcmp(argv[i], "--heap-profile") == 0) heapProfilePath = "pkscript.heap";
+        else if (strncmp(argv[i], "--heap-profile=", 15) == 0) heapProfilePath = argv[i] + 15;
+        else if (strncmp(argv[i], "--heap-sample=", 14) == 0)
+        {
+            heapSample = parseSize(argv[i] + 14);
+            if (heapSample == 0) usage();
+        }
+        else if (strncmp(argv[i], "--max-heap=", 11) == 0)
+        {
+            heapLimit = parseSize(argv[i] + 11);
+            if (heapLimit == 0) usage();
+        }
+        else if (strncmp(argv[i], "--profile-ops", 13) == 0 && (argv[i][13] == '\0' || argv[i][13] == '='))
+        {
+#ifndef PROFILE_OPS
+            std::cerr << "--profile-ops needs a build configured with -DPKSCRIPT_PROFILE_OPS=ON." << std::endl;
+            exit(64);
+#endif
+            if (argv[i][13] == '=') opProfilePath = argv[i] + 14;
+            if (opProfile == nullptr) opProfile = new OpProfile;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) stats = true;
+        else if (strcmp(argv[i], "--stats=json") == 0) stats = statsJson = true;
+        else if (strcmp(argv[i], "--trace") == 0) tracePath = "pkscript.pkt";
+        else if (strncmp(argv[i], "--trace=", 8) == 0) tracePath = argv[i] + 8;
+        else if (strcmp(argv[i], "--decode-trace") == 0)
+        {
+            if (i + 1 != argc - 1) usage();
+            if (!decodeTrace(argv[i + 1]))
+            {
+                std::cerr << "Could not decode trace " << argv[i + 1] << "." << std::endl;
+                exit(65);
+            }
+            exit(0);
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 || strncmp(argv[i], "--jobs=", 7) == 0)
+        {
+            const char* count = argv[i][6] == '=' ? argv[i] + 7 : (i + 1 < argc ? argv[++i] : "");
+            char* end;
+            jobs = (unsigned)strtoul(count, &end, 10);
+            if (jobs == 0 || *end != '\0') usage();
+        }
+        else if (strcmp(argv[i], "--slice") == 0 || strncmp(argv[i], "--slice=", 8) == 0)
+        {
+            const char* count = argv[i][7] == '=' ? argv[i] + 8 : (i + 1 < argc ? argv[++i] : "");
+            char* end;
+            slice = strtoull(count, &end, 10);
+            if (slice == 0 || *end != '\0') usage();
+        }
+        else if (strcmp(argv[i], "--async") == 0) async = true;
+        else if (strcmp(argv[i], "--io") == 0) io = true;
+        else if (strcmp(argv[i], "--serve") == 0 || strncmp(argv[i], "--serve=", 8) == 0)
+        {
+            servePath = argv[i][7] == '=' ? argv[i] + 8 : (i + 1 < argc ? argv[++i] : "");
+            if (servePath.empty()) usage();
+        }
+        else if (strcmp(argv[i], "--workers") == 0 || strncmp(argv[i], "--workers=", 10) == 0)
+        {
+            const char* count = argv[i][9] == '=' ? argv[i] + 10 : (i + 1 < argc ? argv[++i] : "");
+            char* end;
+            serveOptions.workers = (unsigned)strtoul(count, &end, 10);
+            if (serveOptions.workers == 0 || *end != '\0') usage();
+        }
+        else if (strcmp(argv[i], "--max-requests") == 0 || strncmp(argv[i], "--max-requests=", 15) == 0)
+        {
+            const char* count = argv[i][14] == '=' ? argv[i] + 15 : (i + 1 < argc ? argv[++i] : "");
+            char* end;
+            serveOptions.maxRequests = strtoull(count, &end, 10);
+            if (*count == '\0' || *end != '\0') usage();
+        }
+        else if (strcmp(argv[i], "--entry") == 0 || strncmp(argv[i], "--entry=", 8) == 0)
+        {
+            serveOptions.entry = argv[i][7] == '=' ? argv[i] + 8 : (i + 1 < argc ? argv[++i] : "");
+            if (serveOptions.entry.empty()) usage();
+        }
+        else if (strncmp(argv[i], "--snapshot=", 11) == 0) snapshotPath = argv[i] + 11;
+        else if (strncmp(argv[i], "--restore=", 10) == 0) restorePath = argv[i] + 10;
+        else if (strcmp(argv[i], "--manifest") == 0)
+        {
+            if (i + 1 == argc) usage();
+            if (!readManifest(paths, argv[++i]))
+            {
+                std::cerr << "Could not open manifest " << argv[i] << "." << std::endl;
+                exit(74);
+            }
+            if (jobs == 0) jobs = workerCount();
+        }
+        else if (strcmp(argv[i], "--profile-lines") == 0) samplePath = "pkscript.folded";
+        else if (strncmp(argv[i], "--profile-lines=", 16) == 0) samplePath = argv[i] + 16;
+        else if (argv[i][0] == '-') usage();
+        else
+        {
+            std::error_code error;
+            directory |= std::filesystem::is_directory(argv[i], error);
+            addPath(paths, argv[i]);
+        }
+    }
+
+    if (!servePath.empty())
+    {
+        // workers are forks: a profiler or trace would be written by every one of them
+        if (jobs != 0 || async || slice != 0 || !snapshotPath.empty() || directory || paths.size() > 1
+            || (paths.empty() && restorePath.empty()))
+            usage();
+        if (stats || opProfile != nullptr || !tracePath.empty() || !heapProfilePath.empty() || !samplePath.empty())
+        {
+            std::cerr << "--serve cannot be combined with --stats, --trace or the profilers." << std::endl;
+            exit(64);
+        }
+        if (serveOptions.workers == 0) serveOptions.workers = workerCount();
+        VM vm = createVM();
+        vm.useCache = useCache;
+        vm.heapLimit = heapLimit;
+        if (io) defineIoNatives(&vm);
+        if (!restorePath.empty() && !loadSnapshot(&vm, restorePath))
+        {
+            std::cerr << "Could not restore snapshot " << restorePath << "." << std::endl;
+            exit(74);
+        }
+        if (!paths.empty()) runFile(&vm, paths[0], useCache);
+        return serve(&vm, servePath, serveOptions);
+    }
+
+    if (async && jobs == 0) jobs = 1;
+    if (slice != 0 && jobs == 0) jobs = workerCount();
+    if (jobs != 0)
+    {
+        // these report on a single VM, which a batch does not have
+        if (stats || opProfile != nullptr || !tracePath.empty() || !heapProfilePath.empty() || !samplePath.empty())
+        {
+            std::cerr << "--jobs cannot be combined with --stats, --trace or the profilers." << std::endl;
+            exit(64);
+        }
+        if (paths.empty() || !snapshotPath.empty()) usage();
+        BatchOptions options = { useCache, stripLines, heapLimit, slice, async, restorePath, io };
+        EventLoop* probe = async ? newEventLoop(0, nullptr) : nullptr;
+        if (async && probe == nullptr)
+        {
+            std::cerr << "--async needs epoll, which this platform does not have." << std::endl;
+            exit(64);
+        }
+        if (probe != nullptr) freeEventLoop(probe);
+        return runBatch(paths, jobs, options);
+    }
+
     VM vm = createVM();
-    if(argc == 1)
+    vm.useCache = useCache;
+    vm.stripLines = stripLines;
+    vm.heapLimit = heapLimit;
+    if (io) defineIoNatives(&vm);
+    if (!restorePath.empty() && !loadSnapshot(&vm, restorePath))
+    {
+        std::cerr << "Could not restore snapshot " << restorePath << "." << std::endl;
+        exit(74);
+    }
+#ifdef PROFILE_OPS
+    if (opProfile != nullptr)
+    {
+        initOpProfile(opProfile);
+        vm.profile = opProfile;
+        std::atexit(reportOpProfile);
+    }
+#endif
+    if (!tracePath.empty())
+    {
+        vm.trace = openTrace(tracePath);
+        if (vm.trace == nullptr)
+        {
+            std::cerr << "Could not open trace file " << tracePath << "." << std::endl;
+            exit(74);
+        }
+        tracedVM = &vm;
+        std::atexit(reportTrace);
+    }
+    if (!heapProfilePath.empty())
+    {
+        vm.heapProfile = newHeapProfile(heapProfilePath, heapSample);
+        if (vm.heapProfile == nullptr)
+        {
+            std::cerr << "Could not open heap profile " << heapProfilePath << "." << std::endl;
+            exit(74);
+        }
+        heapProfiledVM = &vm;
+        // kill -USR2 writes a dump at the next sampled allocation
+        signal(SIGUSR2, requestHeapDump);
+        std::atexit(reportHeapProfile);
+    }
+    if (stats)
+    {
+        statsVM = &vm;
+        vm.collectStats = true;
+        std::atexit(reportStats);
+    }
+    if (!samplePath.empty())
+    {
+        if (!startSampler(&vm))
+        {
+            std::cerr << "Could not start the line profiler." << std::endl;
+            exit(70);
+        }
+        // a script that fails exits from inside the run, while its functions are still alive
+        std::atexit(reportSamples);
+    }
+    if(paths.empty() && !directory)
     {
         repl(&vm);
     }
-    else if (argc == 2)
+    else if (paths.size() == 1 && !directory)
     {
-        runFile(&vm, std::string(argv[1]));
+        runFile(&vm, paths[0], useCache);
     }
     else
     {
-        std::cerr << "Usage: pkscript [path]\n" << std::endl;
-        exit(64);
+        runFiles(&vm, paths, useCache);
+    }
+    if (!snapshotPath.empty())
+    {
+        std::string error;
+        if (!writeSnapshot(&vm, snapshotPath, &error))
+        {
+            std::cerr << "Could not write snapshot: " << error << "." << std::endl;
+            exit(74);
+        }
     }
+    reportSamples();
+    reportStats();
+    reportTrace();
+    reportHeapProfile();
     freeVM(&vm);
 }
 
@@ -5,5 +5,11 @@
 
 #define ERR(x) std::cout << "Error: " << x << std::endl; abort()
 
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
\ No newline at end of file
+// DEBUG_PRINT_CODE disassembles every chunk as it is compiled.
+//#define DEBUG_PRINT_CODE
+// DEBUG_TRACE_EXECUTION prints the stack and every instruction as it runs. It is far
+// too slow to leave on; --trace records the same information in a compact binary form.
+//#define DEBUG_TRACE_EXECUTION
+
+// PROFILE_OPS (cmake -DPKSCRIPT_PROFILE_OPS=ON) adds a per-instruction hook to run()
+// for --profile-ops. Without it the dispatch loop carries no profiling code at all.
\ No newline at end of file